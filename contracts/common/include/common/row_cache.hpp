@@ -0,0 +1,151 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosiolib/multi_index.hpp>
+
+#include <map>
+
+namespace eosio {
+
+   /**
+    *  Write-back cache layered on top of a multi_index table.
+    *
+    *  Rows are decoded on first access and kept in memory until flush() (or destruction),
+    *  every modify/emplace/erase is applied to the cached copy only, and each dirty row is
+    *  written back exactly once. Actions that touch the same row several times therefore pay
+    *  for a single db write while the resulting table state is identical to issuing the
+    *  individual operations directly.
+    *
+    *  References returned by find/get/emplace stay valid until the cache is destroyed.
+    *  The underlying table must not be modified directly while the cache holds unflushed rows.
+    *
+    *  Built on the eosiolib headers, so only contracts written against <eosiolib/...> can use
+    *  it; currently eosio.system is the only one with contracts/common/include on its path.
+    */
+   template<typename MultiIndex>
+   class row_cache {
+      public:
+         using value_type = typename MultiIndex::value_type;
+
+         explicit row_cache( MultiIndex& table ) : _table( table ) {}
+         ~row_cache() { flush(); }
+
+         row_cache( const row_cache& ) = delete;
+         row_cache& operator=( const row_cache& ) = delete;
+
+         const value_type* find( uint64_t primary ) {
+            auto& e = load( primary );
+            return e.live() ? &e.row : nullptr;
+         }
+
+         const value_type& get( uint64_t primary, const char* error_msg = "unable to find key" ) {
+            auto ptr = find( primary );
+            check( ptr != nullptr, error_msg );
+            return *ptr;
+         }
+
+         template<typename Lambda>
+         const value_type& emplace( name payer, Lambda&& constructor ) {
+            value_type row{};
+            constructor( row );
+
+            auto& e = load( row.primary_key() );
+            check( !e.live(), "could not insert object, most likely a uniqueness constraint was violated" );
+
+            // a row erased earlier in this action still exists in the db, re-creating it is a modify
+            e.state = e.state == row_state::erased ? row_state::dirty : row_state::created;
+            e.row   = std::move( row );
+            e.payer = payer;
+            return e.row;
+         }
+
+         template<typename Lambda>
+         void modify( const value_type& obj, name payer, Lambda&& updater ) {
+            auto itr = _rows.find( obj.primary_key() );
+            check( itr != _rows.end() && itr->second.live(), "object passed to modify is not in row_cache" );
+            auto& e = itr->second;
+
+            const auto pk = e.row.primary_key();
+            updater( e.row );
+            check( pk == e.row.primary_key(), "updater cannot change primary key when modifying an object" );
+
+            if( e.state == row_state::clean )
+               e.state = row_state::dirty;
+            if( payer != same_payer )
+               e.payer = payer;
+         }
+
+         void erase( const value_type& obj ) {
+            auto itr = _rows.find( obj.primary_key() );
+            check( itr != _rows.end() && itr->second.live(), "object passed to erase is not in row_cache" );
+            auto& e = itr->second;
+
+            e.state = e.state == row_state::created ? row_state::absent : row_state::erased;
+            e.payer = same_payer;
+         }
+
+         /**
+          *  Writes every pending change back to the table, one db operation per row.
+          */
+         void flush() {
+            for( auto& item : _rows ) {
+               auto& e = item.second;
+               switch( e.state ) {
+                  case row_state::created:
+                     _table.emplace( e.payer, [&]( auto& r ) { r = e.row; } );
+                     e.state = row_state::clean;
+                     break;
+                  case row_state::dirty:
+                     _table.modify( _table.get( item.first ), e.payer, [&]( auto& r ) { r = e.row; } );
+                     e.state = row_state::clean;
+                     break;
+                  case row_state::erased:
+                     _table.erase( _table.get( item.first ) );
+                     e.state = row_state::absent;
+                     break;
+                  default:
+                     break;
+               }
+               e.payer = same_payer;
+            }
+         }
+
+      private:
+         enum class row_state : uint8_t {
+            absent,   ///< not in the db and not pending creation
+            clean,    ///< identical to the db row
+            dirty,    ///< exists in the db, cached copy differs
+            created,  ///< pending emplace
+            erased    ///< exists in the db, pending erase
+         };
+
+         struct entry {
+            value_type row{};
+            row_state  state = row_state::absent;
+            name       payer;
+
+            bool live()const { return state == row_state::clean || state == row_state::dirty || state == row_state::created; }
+         };
+
+         entry& load( uint64_t primary ) {
+            auto itr = _rows.find( primary );
+            if( itr != _rows.end() )
+               return itr->second;
+
+            auto& e = _rows[primary];
+            auto db_itr = _table.find( primary );
+            if( db_itr != _table.end() ) {
+               e.row   = *db_itr;
+               e.state = row_state::clean;
+            }
+            return e;
+         }
+
+         MultiIndex&                _table;
+         std::map<uint64_t, entry>  _rows;
+   };
+
+} /// namespace eosio
@@ -1,8 +1,11 @@
 #pragma once
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/ignore.hpp>
+#include <eosiolib/singleton.hpp>
 #include <eosiolib/transaction.hpp>
 
+#include <limits>
+
 namespace eosio {
 
    class [[eosio::contract("eosio.msig")]] multisig : public contract {
@@ -33,21 +36,82 @@ namespace eosio {
          [[eosio::action]]
          void invalidate( name account );
 
+         [[eosio::action]]
+         void setlayout( bool unified );
+
+         [[eosio::action]]
+         void setcompress( uint32_t min_size );
+
+         [[eosio::action]]
+         void migrate( name proposer, name lower_bound, uint32_t max );
+
+         [[eosio::action]]
+         void gcexpired( name proposer, uint32_t max );
+
          using approve_action = eosio::action_wrapper<"approve"_n, &multisig::approve>;
          using unapprove_action = eosio::action_wrapper<"unapprove"_n, &multisig::unapprove>;
          using cancel_action = eosio::action_wrapper<"cancel"_n, &multisig::cancel>;
          using exec_action = eosio::action_wrapper<"exec"_n, &multisig::exec>;
          using invalidate_action = eosio::action_wrapper<"invalidate"_n, &multisig::invalidate>;
+         using setlayout_action = eosio::action_wrapper<"setlayout"_n, &multisig::setlayout>;
+         using setcompress_action = eosio::action_wrapper<"setcompress"_n, &multisig::setcompress>;
+         using migrate_action = eosio::action_wrapper<"migrate"_n, &multisig::migrate>;
+         using gcexpired_action = eosio::action_wrapper<"gcexpired"_n, &multisig::gcexpired>;
       private:
+         struct approval {
+            permission_level level;
+            time_point       time;
+         };
+
+         //approvals_id of a unified layout proposal whose approvals are stored in the proposal row
+         static constexpr uint64_t inline_approvals_id = std::numeric_limits<uint64_t>::max();
+
          struct [[eosio::table]] proposal {
             name                            proposal_name;
             std::vector<char>               packed_transaction;
+            //sha256 of packed_transaction, computed once by propose, or by the first approve that
+            //supplies a hash for a proposal created before this field existed
+            eosio::binary_extension<eosio::checksum256> trx_hash;
+            //unified layout (when not 0): the proposal has no "approvals2" or "approvals" row, its approvals are
+            //stored in requested_approvals/provided_approvals below (inline_approvals_id) or one row per approver
+            //in the "apprvls" table under this scope
+            eosio::binary_extension<uint64_t> approvals_id;
+            //value of msig_state::invalidation_epoch when the proposal was created, no_epoch when unknown;
+            //0 is what a rewrite of a row created before this field existed stores and means unknown too
+            eosio::binary_extension<uint64_t> invalidation_epoch;
+            //trx_encoding_lz: packed_transaction holds the transaction compressed with eosio::lz,
+            //trx_hash is always the hash of the uncompressed transaction
+            eosio::binary_extension<uint8_t> trx_encoding;
+            //approvals of a proposal with inline_approvals_id, empty otherwise
+            eosio::binary_extension<std::vector<approval>> requested_approvals;
+            eosio::binary_extension<std::vector<approval>> provided_approvals;
 
             uint64_t primary_key()const { return proposal_name.value; }
+            bool     unified()const { return approvals_id && approvals_id.value(); }
+            bool     has_inline_approvals()const { return unified() && approvals_id.value() == inline_approvals_id; }
+            //scope of the "apprvls" rows of a unified layout proposal, 0 when there are none
+            uint64_t unified_approvals_id()const { return unified() && !has_inline_approvals() ? approvals_id.value() : 0; }
          };
 
          typedef eosio::multi_index< "proposal"_n, proposal > proposals;
 
+         static constexpr uint8_t trx_encoding_raw = 0;
+         static constexpr uint8_t trx_encoding_lz  = 1;
+
+         //expiration of the proposed transaction, kept beside the proposal so that expired
+         //proposals can be found in order without unpacking packed_transaction
+         struct [[eosio::table]] proposal_expiry {
+            name                            proposal_name;
+            time_point_sec                  expiration;
+
+            uint64_t primary_key()const { return proposal_name.value; }
+            uint64_t by_expiration()const { return expiration.sec_since_epoch(); }
+         };
+
+         typedef eosio::multi_index< "expiries"_n, proposal_expiry,
+                                     indexed_by<"byexpiry"_n, const_mem_fun<proposal_expiry, uint64_t, &proposal_expiry::by_expiration>>
+                                   > expiries;
+
          struct [[eosio::table]] old_approvals_info {
             name                            proposal_name;
             std::vector<permission_level>   requested_approvals;
@@ -57,11 +121,6 @@ namespace eosio {
          };
          typedef eosio::multi_index< "approvals"_n, old_approvals_info > old_approvals;
 
-         struct approval {
-            permission_level level;
-            time_point       time;
-         };
-
          struct [[eosio::table]] approvals_info {
             uint8_t                 version = 1;
             name                    proposal_name;
@@ -70,11 +129,42 @@ namespace eosio {
             //doesn't change serialized data size. So, we use the same type.
             std::vector<approval>   requested_approvals;
             std::vector<approval>   provided_approvals;
+            //version 2: both vectors are empty, approvals are stored one row per approver
+            //in the "apprvls" table under this scope
+            eosio::binary_extension<uint64_t> approvals_id;
 
             uint64_t primary_key()const { return proposal_name.value; }
          };
          typedef eosio::multi_index< "approvals2"_n, approvals_info > approvals;
 
+         //proposals requesting more approvals than this keep them in per-approver rows, so that
+         //approve/unapprove cost a primary key lookup and a write of one small row, in either layout
+         static constexpr size_t indexed_approvals_threshold = 16;
+
+         struct [[eosio::table]] approver_info {
+            name                    actor;
+            //permissions of actor, usually only one
+            std::vector<approval>   requested_approvals;
+            std::vector<approval>   provided_approvals;
+
+            uint64_t primary_key()const { return actor.value; }
+         };
+         typedef eosio::multi_index< "apprvls"_n, approver_info > approvers;
+
+         struct [[eosio::table("msigstate")]] msig_state {
+            uint64_t                next_approvals_id = 1;
+            bool                    unified_layout = false;
+            //incremented by every invalidate, lets exec skip invalidation checks entirely
+            //when nothing was invalidated since the proposal was created; never 0 for new state
+            uint64_t                invalidation_epoch = 1;
+            time_point              last_invalidation_time;
+            //proposed transactions of at least this many bytes are stored compressed, 0 disables
+            uint32_t                compress_min_size = 0;
+         };
+
+         static constexpr uint64_t no_epoch = std::numeric_limits<uint64_t>::max();
+         typedef eosio::singleton< "msigstate"_n, msig_state > msig_state_singleton;
+
          struct [[eosio::table]] invalidation {
             name         account;
             time_point   last_invalidation_time;
@@ -83,6 +173,21 @@ namespace eosio {
          };
 
          typedef eosio::multi_index< "invals"_n, invalidation > invalidations;
+
+         uint64_t next_approvals_id();
+         //returns the uncompressed packed transaction, decompressing into buffer when necessary
+         const std::vector<char>& transaction_bytes( const proposal& prop, std::vector<char>& buffer );
+         void approve_inline( proposals& proptable, const proposal& prop, name payer, const permission_level& level );
+         void unapprove_inline( proposals& proptable, const proposal& prop, name payer, const permission_level& level );
+         void store_approvers( uint64_t approvals_id, name payer,
+                               const std::vector<approval>& requested, const std::vector<approval>& provided );
+         void approve_indexed( uint64_t approvals_id, name payer, const permission_level& level );
+         void unapprove_indexed( uint64_t approvals_id, name payer, const permission_level& level );
+         void erase_approvers( uint64_t approvals_id );
+         void erase_approvals( name proposer, const proposal& prop );
+         void erase_expiry( name proposer, name proposal_name );
+         void collect_approvers( uint64_t approvals_id, std::vector<approval>& provided );
+         std::vector<permission_level> valid_approvals( std::vector<approval>& provided );
    };
 
 } /// namespace eosio
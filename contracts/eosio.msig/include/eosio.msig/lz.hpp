@@ -0,0 +1,135 @@
+#pragma once
+#include <eosiolib/eosio.hpp>
+
+#include <cstring>
+#include <vector>
+
+namespace eosio { namespace lz {
+
+   /**
+    *  Minimal LZ77 codec used to store large proposed transactions.
+    *
+    *  Layout: varuint32 uncompressed size, followed by sequences of
+    *    token       high nibble literal count, low nibble match length - min_match (15 = continued)
+    *    [ext]       bytes of 255 continuing the literal count, terminated by a byte < 255
+    *    literals
+    *    offset      2 bytes little endian, distance back into the output (omitted after the last literals)
+    *    [ext]       continuation of the match length, same encoding as for literals
+    */
+   static constexpr size_t   min_match   = 4;
+   static constexpr size_t   max_offset  = 0xffff;
+   static constexpr uint32_t hash_bits   = 12;
+
+   namespace detail {
+      inline uint32_t read32( const char* p ) {
+         uint32_t v;
+         memcpy( &v, p, sizeof(v) );
+         return v;
+      }
+
+      inline void write_length( std::vector<char>& out, size_t len ) {
+         for( ; len >= 255; len -= 255 )
+            out.push_back( char(255) );
+         out.push_back( char(len) );
+      }
+
+      inline size_t read_length( const char*& in, const char* end, size_t len ) {
+         if( len != 15 )
+            return len;
+         uint8_t b;
+         do {
+            check( in < end, "corrupted compressed data" );
+            b = uint8_t(*in++);
+            len += b;
+         } while( b == 255 );
+         return len;
+      }
+
+      inline void write_sequence( std::vector<char>& out, const char* lit, size_t lit_len, size_t offset, size_t match_len ) {
+         const size_t ml = match_len ? match_len - min_match : 0;
+         out.push_back( char( ( (lit_len < 15 ? lit_len : 15) << 4 ) | (ml < 15 ? ml : 15) ) );
+         if( lit_len >= 15 )
+            write_length( out, lit_len - 15 );
+         out.insert( out.end(), lit, lit + lit_len );
+         if( !match_len )
+            return;
+         out.push_back( char(offset & 0xff) );
+         out.push_back( char(offset >> 8) );
+         if( ml >= 15 )
+            write_length( out, ml - 15 );
+      }
+   }
+
+   inline std::vector<char> compress( const char* src, size_t size ) {
+      std::vector<char> out;
+      out.reserve( size / 2 + 16 );
+      {
+         const unsigned_int raw_size{ uint32_t(size) };
+         auto packed_size = pack( raw_size );
+         out.insert( out.end(), packed_size.begin(), packed_size.end() );
+      }
+
+      std::vector<uint32_t> table( size_t(1) << hash_bits, 0 ); // position + 1, 0 is empty
+      size_t anchor = 0;
+      size_t pos    = 0;
+      while( pos + min_match <= size ) {
+         const uint32_t seq = detail::read32( src + pos );
+         const uint32_t h   = ( seq * 2654435761u ) >> ( 32 - hash_bits );
+         const size_t   cand = table[h];
+         table[h] = uint32_t(pos + 1);
+
+         if( cand == 0 || pos - (cand - 1) > max_offset || detail::read32( src + cand - 1 ) != seq ) {
+            ++pos;
+            continue;
+         }
+
+         const size_t match = cand - 1;
+         size_t len = min_match;
+         while( pos + len < size && src[match + len] == src[pos + len] )
+            ++len;
+
+         detail::write_sequence( out, src + anchor, pos - anchor, pos - match, len );
+         pos   += len;
+         anchor = pos;
+      }
+      detail::write_sequence( out, src + anchor, size - anchor, 0, 0 );
+      return out;
+   }
+
+   inline std::vector<char> decompress( const char* src, size_t size ) {
+      datastream<const char*> ds( src, size );
+      unsigned_int raw_size;
+      ds >> raw_size;
+
+      std::vector<char> out;
+      out.reserve( raw_size.value );
+
+      const char* in  = ds.pos();
+      const char* end = src + size;
+      while( in < end ) {
+         const uint8_t token = uint8_t(*in++);
+
+         const size_t lit_len = detail::read_length( in, end, token >> 4 );
+         check( size_t(end - in) >= lit_len, "corrupted compressed data" );
+         out.insert( out.end(), in, in + lit_len );
+         in += lit_len;
+         if( in == end )
+            break;
+
+         check( end - in >= 2, "corrupted compressed data" );
+         const size_t offset = uint8_t(in[0]) | ( size_t(uint8_t(in[1])) << 8 );
+         in += 2;
+         check( 0 < offset && offset <= out.size(), "corrupted compressed data" );
+
+         const size_t match_len = detail::read_length( in, end, token & 0x0f ) + min_match;
+         check( out.size() + match_len <= raw_size.value, "corrupted compressed data" );
+         // byte by byte, a match may overlap the bytes it produces
+         for( size_t i = 0, from = out.size() - offset; i < match_len; ++i )
+            out.push_back( out[from + i] );
+      }
+
+      check( out.size() == raw_size.value, "corrupted compressed data" );
+      return out;
+   }
+
+} } /// namespace eosio::lz
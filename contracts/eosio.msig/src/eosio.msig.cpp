@@ -1,8 +1,12 @@
 #include <eosio.msig/eosio.msig.hpp>
+#include <eosio.msig/lz.hpp>
 #include <eosiolib/action.hpp>
 #include <eosiolib/permission.hpp>
 #include <eosiolib/crypto.hpp>
 
+#include <algorithm>
+#include <map>
+
 namespace eosio {
 
 time_point current_time_point() {
@@ -40,20 +44,76 @@ void multisig::propose( ignore<name> proposer,
                                                );
    check( res > 0, "transaction authorization failed" );
 
+   msig_state_singleton state( _self, _self.value );
+   auto st = state.get_or_default();
+   const bool unified = st.unified_layout;
+   const bool indexed = _requested.size() > indexed_approvals_threshold;
+   uint64_t approvals_id = 0;
+   if ( indexed ) {
+      approvals_id = st.next_approvals_id++;
+      state.set( st, _self );
+   }
+
    std::vector<char> pkd_trans;
-   pkd_trans.resize(size);
-   memcpy((char*)pkd_trans.data(), trx_pos, size);
+   uint8_t encoding = trx_encoding_raw;
+   if ( st.compress_min_size && size >= st.compress_min_size ) {
+      pkd_trans = lz::compress( trx_pos, size );
+      encoding  = trx_encoding_lz;
+   }
+   if ( encoding == trx_encoding_raw || pkd_trans.size() >= size ) { // not compressed, or compression did not pay off
+      pkd_trans.resize(size);
+      memcpy((char*)pkd_trans.data(), trx_pos, size);
+      encoding = trx_encoding_raw;
+   } else {
+      //exec and cancel decompress the stored form, make sure it gives back the proposed transaction
+      const auto restored = lz::decompress( pkd_trans.data(), pkd_trans.size() );
+      check( restored.size() == size && memcmp( restored.data(), trx_pos, size ) == 0, "compressed transaction does not match" );
+   }
+
+   std::vector<approval> requested_approvals;
+   requested_approvals.reserve( _requested.size() );
+   for ( auto& level : _requested ) {
+      requested_approvals.push_back( approval{ level, time_point{ microseconds{0} } } );
+   }
+
+   const bool inlined = unified && !indexed;
    proptable.emplace( _proposer, [&]( auto& prop ) {
       prop.proposal_name       = _proposal_name;
-      prop.packed_transaction  = pkd_trans;
+      prop.packed_transaction  = std::move( pkd_trans );
+      prop.trx_hash.emplace( sha256( trx_pos, size ) );
+      prop.approvals_id.emplace( inlined ? inline_approvals_id : unified ? approvals_id : 0 );
+      //an invalidation in this very block carries the same time as approvals given in it,
+      //so the epoch shortcut in exec cannot be used for such a proposal
+      prop.invalidation_epoch.emplace( st.last_invalidation_time < current_time_point() ? st.invalidation_epoch : no_epoch );
+      prop.trx_encoding.emplace( encoding );
+      prop.requested_approvals.emplace( inlined ? std::move( requested_approvals ) : std::vector<approval>{} );
+      prop.provided_approvals.emplace();
    });
 
+   expiries exptable( _self, _proposer.value );
+   exptable.emplace( _proposer, [&]( auto& e ) {
+      e.proposal_name = _proposal_name;
+      e.expiration    = _trx_header.expiration;
+   });
+
+   if ( inlined ) {
+      return;
+   }
+   if ( indexed ) {
+      store_approvers( approvals_id, _proposer, requested_approvals, {} );
+   }
+   if ( unified ) {
+      return;
+   }
+
    approvals apptable(  _self, _proposer.value );
    apptable.emplace( _proposer, [&]( auto& a ) {
       a.proposal_name       = _proposal_name;
-      a.requested_approvals.reserve( _requested.size() );
-      for ( auto& level : _requested ) {
-         a.requested_approvals.push_back( approval{ level, time_point{ microseconds{0} } } );
+      if ( indexed ) {
+         a.version = 2;
+         a.approvals_id.emplace( approvals_id );
+      } else {
+         a.requested_approvals = std::move( requested_approvals );
       }
    });
 }
@@ -63,15 +123,35 @@ void multisig::approve( name proposer, name proposal_name, permission_level leve
 {
    require_auth( level );
 
+   proposals proptable( _self, proposer.value );
+   auto& prop = proptable.get( proposal_name.value, "proposal not found" );
+
    if( proposal_hash ) {
-      proposals proptable( _self, proposer.value );
-      auto& prop = proptable.get( proposal_name.value, "proposal not found" );
-      assert_sha256( prop.packed_transaction.data(), prop.packed_transaction.size(), *proposal_hash );
+      if( !prop.trx_hash ) {
+         proptable.modify( prop, proposer, [&]( auto& p ) {
+            p.trx_hash.emplace( sha256( p.packed_transaction.data(), p.packed_transaction.size() ) );
+            if ( !p.invalidation_epoch ) {
+               p.invalidation_epoch.emplace( no_epoch );
+            }
+         });
+      }
+      check( *prop.trx_hash == *proposal_hash, "hash mismatch" );
+   }
+
+   if ( prop.has_inline_approvals() ) {
+      approve_inline( proptable, prop, proposer, level );
+      return;
+   }
+   if ( prop.unified_approvals_id() ) {
+      approve_indexed( prop.unified_approvals_id(), proposer, level );
+      return;
    }
 
    approvals apptable(  _self, proposer.value );
    auto apps_it = apptable.find( proposal_name.value );
-   if ( apps_it != apptable.end() ) {
+   if ( apps_it != apptable.end() && apps_it->version >= 2 ) {
+      approve_indexed( apps_it->approvals_id.value(), proposer, level );
+   } else if ( apps_it != apptable.end() ) {
       auto itr = std::find_if( apps_it->requested_approvals.begin(), apps_it->requested_approvals.end(), [&](const approval& a) { return a.level == level; } );
       check( itr != apps_it->requested_approvals.end(), "approval is not on the list of requested approvals" );
 
@@ -96,9 +176,22 @@ void multisig::approve( name proposer, name proposal_name, permission_level leve
 void multisig::unapprove( name proposer, name proposal_name, permission_level level ) {
    require_auth( level );
 
+   proposals proptable( _self, proposer.value );
+   auto& prop = proptable.get( proposal_name.value, "proposal not found" );
+   if ( prop.has_inline_approvals() ) {
+      unapprove_inline( proptable, prop, proposer, level );
+      return;
+   }
+   if ( prop.unified_approvals_id() ) {
+      unapprove_indexed( prop.unified_approvals_id(), proposer, level );
+      return;
+   }
+
    approvals apptable(  _self, proposer.value );
    auto apps_it = apptable.find( proposal_name.value );
-   if ( apps_it != apptable.end() ) {
+   if ( apps_it != apptable.end() && apps_it->version >= 2 ) {
+      unapprove_indexed( apps_it->approvals_id.value(), proposer, level );
+   } else if ( apps_it != apptable.end() ) {
       auto itr = std::find_if( apps_it->provided_approvals.begin(), apps_it->provided_approvals.end(), [&](const approval& a) { return a.level == level; } );
       check( itr != apps_it->provided_approvals.end(), "no approval previously granted" );
       apptable.modify( apps_it, proposer, [&]( auto& a ) {
@@ -124,21 +217,13 @@ void multisig::cancel( name proposer, name proposal_name, name canceler ) {
    auto& prop = proptable.get( proposal_name.value, "proposal not found" );
 
    if( canceler != proposer ) {
-      check( unpack<transaction_header>( prop.packed_transaction ).expiration < eosio::time_point_sec(current_time_point()), "cannot cancel until expiration" );
+      std::vector<char> buffer;
+      check( unpack<transaction_header>( transaction_bytes( prop, buffer ) ).expiration < eosio::time_point_sec(current_time_point()), "cannot cancel until expiration" );
    }
-   proptable.erase(prop);
 
-   //remove from new table
-   approvals apptable(  _self, proposer.value );
-   auto apps_it = apptable.find( proposal_name.value );
-   if ( apps_it != apptable.end() ) {
-      apptable.erase(apps_it);
-   } else {
-      old_approvals old_apptable(  _self, proposer.value );
-      auto apps_it = old_apptable.find( proposal_name.value );
-      check( apps_it != old_apptable.end(), "proposal not found" );
-      old_apptable.erase(apps_it);
-   }
+   erase_approvals( proposer, prop );
+   erase_expiry( proposer, proposal_name );
+   proptable.erase(prop);
 }
 
 void multisig::exec( name proposer, name proposal_name, name executer ) {
@@ -146,48 +231,331 @@ void multisig::exec( name proposer, name proposal_name, name executer ) {
 
    proposals proptable( _self, proposer.value );
    auto& prop = proptable.get( proposal_name.value, "proposal not found" );
+   std::vector<char> buffer;
+   const auto& trx = transaction_bytes( prop, buffer );
    transaction_header trx_header;
-   datastream<const char*> ds( prop.packed_transaction.data(), prop.packed_transaction.size() );
+   datastream<const char*> ds( trx.data(), trx.size() );
    ds >> trx_header;
    check( trx_header.expiration >= eosio::time_point_sec(current_time_point()), "transaction expired" );
 
-   approvals apptable(  _self, proposer.value );
-   auto apps_it = apptable.find( proposal_name.value );
-   std::vector<permission_level> approvals;
-   invalidations inv_table( _self, _self.value );
-   if ( apps_it != apptable.end() ) {
-      approvals.reserve( apps_it->provided_approvals.size() );
-      for ( auto& p : apps_it->provided_approvals ) {
-         auto it = inv_table.find( p.level.actor.value );
-         if ( it == inv_table.end() || it->last_invalidation_time < p.time ) {
-            approvals.push_back(p.level);
-         }
-      }
-      apptable.erase(apps_it);
+   std::vector<approval> provided;
+   if ( prop.has_inline_approvals() ) {
+      provided = prop.provided_approvals.value();
+   } else if ( prop.unified_approvals_id() ) {
+      collect_approvers( prop.unified_approvals_id(), provided );
    } else {
-      old_approvals old_apptable(  _self, proposer.value );
-      auto& apps = old_apptable.get( proposal_name.value, "proposal not found" );
-      for ( auto& level : apps.provided_approvals ) {
-         auto it = inv_table.find( level.actor.value );
-         if ( it == inv_table.end() ) {
-            approvals.push_back( level );
+      approvals apptable(  _self, proposer.value );
+      auto apps_it = apptable.find( proposal_name.value );
+      if ( apps_it != apptable.end() && apps_it->version >= 2 ) {
+         collect_approvers( apps_it->approvals_id.value(), provided );
+         apptable.erase(apps_it);
+      } else if ( apps_it != apptable.end() ) {
+         provided = apps_it->provided_approvals;
+         apptable.erase(apps_it);
+      } else {
+         old_approvals old_apptable(  _self, proposer.value );
+         auto& apps = old_apptable.get( proposal_name.value, "proposal not found" );
+         //legacy approvals carry no time, time 0 makes any invalidation revoke them
+         provided.reserve( apps.provided_approvals.size() );
+         for ( auto& level : apps.provided_approvals ) {
+            provided.push_back( approval{ level, time_point{ microseconds{0} } } );
          }
+         old_apptable.erase(apps);
+      }
+   }
+
+   std::vector<permission_level> approvals;
+   msig_state_singleton state( _self, _self.value );
+   const uint64_t epoch = prop.invalidation_epoch ? prop.invalidation_epoch.value() : no_epoch;
+   if ( epoch != 0 && epoch == state.get_or_default().invalidation_epoch ) {
+      //nobody invalidated since the proposal was created, every approval is still valid
+      approvals.reserve( provided.size() );
+      for ( auto& p : provided ) {
+         approvals.push_back( p.level );
       }
-      old_apptable.erase(apps);
+   } else {
+      approvals = valid_approvals( provided );
    }
    auto packed_provided_approvals = pack(approvals);
-   auto res = ::check_transaction_authorization( prop.packed_transaction.data(), prop.packed_transaction.size(),
+   auto res = ::check_transaction_authorization( trx.data(), trx.size(),
                                                  (const char*)0, 0,
                                                  packed_provided_approvals.data(), packed_provided_approvals.size()
                                                  );
    check( res > 0, "transaction authorization failed" );
 
    send_deferred( (uint128_t(proposer.value) << 64) | proposal_name.value, executer.value,
-                  prop.packed_transaction.data(), prop.packed_transaction.size() );
+                  trx.data(), trx.size() );
 
+   erase_expiry( proposer, proposal_name );
    proptable.erase(prop);
 }
 
+void multisig::setcompress( uint32_t min_size ) {
+   require_auth( _self );
+
+   msig_state_singleton state( _self, _self.value );
+   auto st = state.get_or_default();
+   st.compress_min_size = min_size;
+   state.set( st, _self );
+}
+
+void multisig::setlayout( bool unified ) {
+   require_auth( _self );
+
+   msig_state_singleton state( _self, _self.value );
+   auto st = state.get_or_default();
+   st.unified_layout = unified;
+   state.set( st, _self );
+}
+
+void multisig::migrate( name proposer, name lower_bound, uint32_t max ) {
+   require_auth( proposer );
+   check( max > 0, "max must be positive" );
+
+   proposals proptable( _self, proposer.value );
+   approvals apptable(  _self, proposer.value );
+   old_approvals old_apptable(  _self, proposer.value );
+   expiries exptable( _self, proposer.value );
+
+   //legacy approvals carry no time, time 0 keeps exec treating any invalidation as revoking them
+   auto to_approvals = []( const std::vector<permission_level>& levels ) {
+      std::vector<approval> result;
+      result.reserve( levels.size() );
+      for ( auto& level : levels ) {
+         result.push_back( approval{ level, time_point{ microseconds{0} } } );
+      }
+      return result;
+   };
+
+   //proposals that are already unified count against max as well, so a call stays bounded;
+   //larger sets are migrated page by page starting at lower_bound
+   uint32_t visited = 0;
+   for ( auto it = proptable.lower_bound( lower_bound.value ); it != proptable.end() && visited < max; ++it, ++visited ) {
+      if ( it->unified() ) {
+         continue;
+      }
+
+      uint64_t approvals_id = 0;
+      std::vector<approval> requested, provided;
+      auto apps_it = apptable.find( it->proposal_name.value );
+      if ( apps_it != apptable.end() && apps_it->version >= 2 ) {
+         approvals_id = apps_it->approvals_id.value();
+         apptable.erase( apps_it );
+      } else if ( apps_it != apptable.end() ) {
+         requested = apps_it->requested_approvals;
+         provided  = apps_it->provided_approvals;
+         apptable.erase( apps_it );
+      } else {
+         auto& apps = old_apptable.get( it->proposal_name.value, "proposal not found" );
+         requested = to_approvals( apps.requested_approvals );
+         provided  = to_approvals( apps.provided_approvals );
+         old_apptable.erase( apps );
+      }
+
+      if ( !approvals_id && requested.size() + provided.size() > indexed_approvals_threshold ) {
+         approvals_id = next_approvals_id();
+         store_approvers( approvals_id, proposer, requested, provided );
+         requested.clear();
+         provided.clear();
+      }
+
+      proptable.modify( it, same_payer, [&]( auto& p ) {
+         if ( !p.trx_hash ) {
+            p.trx_hash.emplace( sha256( p.packed_transaction.data(), p.packed_transaction.size() ) );
+         }
+         p.approvals_id.emplace( approvals_id ? approvals_id : inline_approvals_id );
+         if ( !p.invalidation_epoch ) {
+            p.invalidation_epoch.emplace( no_epoch );
+         }
+         p.requested_approvals.emplace( std::move( requested ) );
+         p.provided_approvals.emplace( std::move( provided ) );
+      });
+      if ( exptable.find( it->proposal_name.value ) == exptable.end() ) {
+         exptable.emplace( proposer, [&]( auto& e ) {
+            e.proposal_name = it->proposal_name;
+            std::vector<char> buffer;
+            e.expiration    = unpack<transaction_header>( transaction_bytes( *it, buffer ) ).expiration;
+         });
+      }
+   }
+
+   check( visited > 0, "nothing to migrate" );
+}
+
+void multisig::gcexpired( name proposer, uint32_t max ) {
+   check( max > 0, "max must be positive" );
+
+   proposals proptable( _self, proposer.value );
+   expiries exptable( _self, proposer.value );
+   auto idx = exptable.get_index<"byexpiry"_n>();
+   const auto now = eosio::time_point_sec(current_time_point());
+
+   uint32_t erased = 0;
+   for ( auto it = idx.begin(); it != idx.end() && it->expiration < now && erased < max; ++erased ) {
+      auto& prop = proptable.get( it->proposal_name.value, "proposal not found" );
+      it = idx.erase( it );
+      erase_approvals( proposer, prop );
+      proptable.erase( prop );
+   }
+
+   check( erased > 0, "no expired proposals" );
+}
+
+void multisig::erase_approvals( name proposer, const proposal& prop ) {
+   if ( prop.has_inline_approvals() ) {
+      return;
+   }
+   if ( prop.unified_approvals_id() ) {
+      erase_approvers( prop.unified_approvals_id() );
+      return;
+   }
+
+   approvals apptable(  _self, proposer.value );
+   auto apps_it = apptable.find( prop.proposal_name.value );
+   if ( apps_it != apptable.end() ) {
+      if ( apps_it->version >= 2 ) {
+         erase_approvers( apps_it->approvals_id.value() );
+      }
+      apptable.erase(apps_it);
+   } else {
+      old_approvals old_apptable(  _self, proposer.value );
+      auto apps_it = old_apptable.find( prop.proposal_name.value );
+      check( apps_it != old_apptable.end(), "proposal not found" );
+      old_apptable.erase(apps_it);
+   }
+}
+
+void multisig::erase_expiry( name proposer, name proposal_name ) {
+   //proposals created before the expiry index existed have no entry
+   expiries exptable( _self, proposer.value );
+   auto it = exptable.find( proposal_name.value );
+   if ( it != exptable.end() ) {
+      exptable.erase( it );
+   }
+}
+
+void multisig::approve_inline( proposals& proptable, const proposal& prop, name payer, const permission_level& level ) {
+   const auto& requested = prop.requested_approvals.value();
+   auto itr = std::find_if( requested.begin(), requested.end(), [&](const approval& a) { return a.level == level; } );
+   check( itr != requested.end(), "approval is not on the list of requested approvals" );
+
+   proptable.modify( prop, payer, [&]( auto& p ) {
+         p.provided_approvals.value().push_back( approval{ level, current_time_point() } );
+         p.requested_approvals.value().erase( itr );
+      });
+}
+
+void multisig::unapprove_inline( proposals& proptable, const proposal& prop, name payer, const permission_level& level ) {
+   const auto& provided = prop.provided_approvals.value();
+   auto itr = std::find_if( provided.begin(), provided.end(), [&](const approval& a) { return a.level == level; } );
+   check( itr != provided.end(), "no approval previously granted" );
+
+   proptable.modify( prop, payer, [&]( auto& p ) {
+         p.requested_approvals.value().push_back( approval{ level, current_time_point() } );
+         p.provided_approvals.value().erase( itr );
+      });
+}
+
+void multisig::store_approvers( uint64_t approvals_id, name payer,
+                                const std::vector<approval>& requested, const std::vector<approval>& provided ) {
+   std::map<name, approver_info> by_actor;
+   for ( auto& a : requested ) {
+      by_actor[a.level.actor].requested_approvals.push_back( a );
+   }
+   for ( auto& a : provided ) {
+      by_actor[a.level.actor].provided_approvals.push_back( a );
+   }
+
+   approvers apprtable( _self, approvals_id );
+   for ( auto& r : by_actor ) {
+      apprtable.emplace( payer, [&]( auto& a ) {
+         a.actor               = r.first;
+         a.requested_approvals = std::move( r.second.requested_approvals );
+         a.provided_approvals  = std::move( r.second.provided_approvals );
+      });
+   }
+}
+
+void multisig::approve_indexed( uint64_t approvals_id, name payer, const permission_level& level ) {
+   approvers apprtable( _self, approvals_id );
+   auto& appr = apprtable.get( level.actor.value, "approval is not on the list of requested approvals" );
+   auto itr = std::find_if( appr.requested_approvals.begin(), appr.requested_approvals.end(), [&](const approval& a) { return a.level == level; } );
+   check( itr != appr.requested_approvals.end(), "approval is not on the list of requested approvals" );
+
+   apprtable.modify( appr, payer, [&]( auto& a ) {
+         a.provided_approvals.push_back( approval{ level, current_time_point() } );
+         a.requested_approvals.erase( itr );
+      });
+}
+
+void multisig::unapprove_indexed( uint64_t approvals_id, name payer, const permission_level& level ) {
+   approvers apprtable( _self, approvals_id );
+   auto& appr = apprtable.get( level.actor.value, "no approval previously granted" );
+   auto itr = std::find_if( appr.provided_approvals.begin(), appr.provided_approvals.end(), [&](const approval& a) { return a.level == level; } );
+   check( itr != appr.provided_approvals.end(), "no approval previously granted" );
+
+   apprtable.modify( appr, payer, [&]( auto& a ) {
+         a.requested_approvals.push_back( approval{ level, current_time_point() } );
+         a.provided_approvals.erase( itr );
+      });
+}
+
+void multisig::erase_approvers( uint64_t approvals_id ) {
+   approvers apprtable( _self, approvals_id );
+   for ( auto it = apprtable.begin(); it != apprtable.end(); ) {
+      it = apprtable.erase(it);
+   }
+}
+
+void multisig::collect_approvers( uint64_t approvals_id, std::vector<approval>& provided ) {
+   approvers apprtable( _self, approvals_id );
+   for ( auto it = apprtable.begin(); it != apprtable.end(); ) {
+      provided.insert( provided.end(), it->provided_approvals.begin(), it->provided_approvals.end() );
+      it = apprtable.erase(it);
+   }
+}
+
+std::vector<permission_level> multisig::valid_approvals( std::vector<approval>& provided ) {
+   //walk approvals and the invalidation table in account order: a lookup is only needed when the
+   //current invalidation row is behind the approving account, every account before it is known clean
+   std::sort( provided.begin(), provided.end(), []( const approval& a, const approval& b ) {
+      return a.level.actor < b.level.actor;
+   });
+
+   std::vector<permission_level> approvals;
+   approvals.reserve( provided.size() );
+   invalidations inv_table( _self, _self.value );
+   auto inv = inv_table.end();
+   bool positioned = false;
+   for ( auto& p : provided ) {
+      if ( !positioned || ( inv != inv_table.end() && inv->account < p.level.actor ) ) {
+         inv = inv_table.lower_bound( p.level.actor.value );
+         positioned = true;
+      }
+      if ( inv == inv_table.end() || inv->account != p.level.actor || inv->last_invalidation_time < p.time ) {
+         approvals.push_back( p.level );
+      }
+   }
+   return approvals;
+}
+
+const std::vector<char>& multisig::transaction_bytes( const proposal& prop, std::vector<char>& buffer ) {
+   if ( !prop.trx_encoding || prop.trx_encoding.value() == trx_encoding_raw ) {
+      return prop.packed_transaction;
+   }
+   check( prop.trx_encoding.value() == trx_encoding_lz, "unknown transaction encoding" );
+   buffer = lz::decompress( prop.packed_transaction.data(), prop.packed_transaction.size() );
+   return buffer;
+}
+
+uint64_t multisig::next_approvals_id() {
+   msig_state_singleton state( _self, _self.value );
+   auto st = state.get_or_default();
+   const uint64_t id = st.next_approvals_id++;
+   state.set( st, _self );
+   return id;
+}
+
 void multisig::invalidate( name account ) {
    require_auth( account );
    invalidations inv_table( _self, _self.value );
@@ -202,8 +570,14 @@ void multisig::invalidate( name account ) {
             i.last_invalidation_time = current_time_point();
          });
    }
+
+   msig_state_singleton state( _self, _self.value );
+   auto st = state.get_or_default();
+   ++st.invalidation_epoch;
+   st.last_invalidation_time = current_time_point();
+   state.set( st, _self );
 }
 
 } /// namespace eosio
 
-EOSIO_DISPATCH( eosio::multisig, (propose)(approve)(unapprove)(cancel)(exec)(invalidate) )
+EOSIO_DISPATCH( eosio::multisig, (propose)(approve)(unapprove)(cancel)(exec)(invalidate)(setlayout)(setcompress)(migrate)(gcexpired) )
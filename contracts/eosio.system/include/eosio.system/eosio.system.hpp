@@ -9,8 +9,11 @@
 #include <eosiolib/time.hpp>
 #include <eosiolib/privileged.hpp>
 #include <eosiolib/singleton.hpp>
+#include <eosiolib/binary_extension.hpp>
 
 #include <string>
+#include <cstring>
+#include <limits>
 #include <deque>
 #include <type_traits>
 #include <optional>
@@ -170,13 +173,64 @@ namespace eosiosystem {
 
    struct [[eosio::table, eosio::contract("eosio.system")]] voter_info {
       name                owner;     /// the voter
-      std::vector<name>   producers; /// the producers approved by this voter
+      std::vector<name>   producers; /// the producers approved by this voter, empty once ballot_id is present
       int64_t             staked = 0;
+      eosio::binary_extension<uint64_t> ballot_id; /// row of the shared `ballots` table holding the producers, 0 for none
 
       uint64_t primary_key()const { return owner.value; }
+      bool     has_votes()const   { return producers.size() || ( ballot_id && *ballot_id ); }
 
       // explicit serialization macro is not necessary, used here only to improve compilation time
-      EOSLIB_SERIALIZE( voter_info, (owner)(producers)(staked) )
+      EOSLIB_SERIALIZE( voter_info, (owner)(producers)(staked)(ballot_id) )
+   };
+
+   /**
+    * Producer lists shared by every voter that approved exactly the same producers. A ballot sits
+    * at the first free id from the hash of its list and is erased when no voter refers to it;
+    * ballots never move, so ids held by voters stay valid.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] ballot {
+      uint64_t            id;
+      std::vector<name>   producers;
+      uint32_t            refs = 0;
+
+      uint64_t primary_key()const { return id; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( ballot, (id)(producers)(refs) )
+   };
+
+   /**
+    * Active producers ordered by location, then by vote weight, kept next to the producers table
+    * since an index cannot be added to its existing rows.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] producer_location {
+      name        owner;
+      uint128_t   location_key; /// see make_location_key
+
+      uint64_t  primary_key()const { return owner.value; }
+      uint128_t by_location()const { return location_key; }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( producer_location, (owner)(location_key) )
+   };
+
+   /// location in the high half, vote weight in the low half inverted so higher weights come first
+   inline uint128_t make_location_key( uint16_t location, double total_vote_weight ) {
+      uint64_t weight_bits = 0;
+      if( total_vote_weight > 0 ) {
+         // non-negative doubles order like their bit patterns
+         memcpy( &weight_bits, &total_vote_weight, sizeof(weight_bits) );
+      }
+      return ( static_cast<uint128_t>(location) << 64 ) | ( std::numeric_limits<uint64_t>::max() - weight_bits );
+   }
+
+   struct [[eosio::table("schedmode"), eosio::contract("eosio.system")]] schedule_mode_state {
+      uint16_t     max_per_location = 0; /// 0 schedules the top producers regardless of location
+      name         next_indexed;         /// first producer the next indexprods call looks at
+      bool         indexed = false;      /// every producer registered before prodlocs existed is in it
+
+      EOSLIB_SERIALIZE( schedule_mode_state, (max_per_location)(next_indexed)(indexed) )
    };
 
    struct [[eosio::table("upgrade"), eosio::contract("eosio.system")]] upgrade_state  {
@@ -192,7 +246,40 @@ namespace eosiosystem {
                                indexed_by<"prototalvote"_n, const_mem_fun<producer_info, double, &producer_info::by_votes>  >
                                > producers_table;
 
+   typedef eosio::multi_index< "prodlocs"_n, producer_location,
+                               indexed_by<"bylocation"_n, const_mem_fun<producer_location, uint128_t, &producer_location::by_location>  >
+                               > producer_locations_table;
+
+   typedef eosio::singleton< "schedmode"_n, schedule_mode_state > schedule_mode_singleton;
+
    typedef eosio::multi_index< "voters"_n, voter_info >  voters_table;
+   typedef eosio::multi_index< "ballots"_n, ballot >     ballots_table;
+
+   /**
+    * Stake of the voters of a ballot, by account type. Stake changes of the voters of a shared
+    * ballot accumulate in the pending fields and reach the producers' tallies in one pass per
+    * ballot, oldest first, see tallyballots.
+    */
+   struct [[eosio::table, eosio::contract("eosio.system")]] ballot_stake {
+      uint64_t   ballot_id;
+      int64_t    company_staked = 0;
+      int64_t    government_staked = 0;
+      int64_t    company_pending = 0;
+      int64_t    government_pending = 0;
+      uint64_t   pending_since = 0; /// microseconds since epoch of the oldest pending change
+
+      uint64_t primary_key()const { return ballot_id; }
+      bool     has_pending()const { return company_pending || government_pending; }
+      uint64_t by_pending()const  { return has_pending() ? pending_since : std::numeric_limits<uint64_t>::max(); }
+
+      // explicit serialization macro is not necessary, used here only to improve compilation time
+      EOSLIB_SERIALIZE( ballot_stake, (ballot_id)(company_staked)(government_staked)(company_pending)(government_pending)(pending_since) )
+   };
+
+   typedef eosio::multi_index< "ballotstake"_n, ballot_stake,
+                               indexed_by<"bypending"_n, const_mem_fun<ballot_stake, uint64_t, &ballot_stake::by_pending>  >
+                               > ballot_stakes_table;
+
    typedef eosio::singleton< "upgrade"_n, upgrade_state > upgrade_singleton;
 
    static constexpr uint32_t     seconds_per_day = 24 * 3600;
@@ -281,6 +368,30 @@ namespace eosiosystem {
          [[eosio::action]]
          void refund( name owner );
 
+         struct delegation_entry {
+            name    to;
+            asset   net_weight;
+            asset   cpu_weight;
+         };
+
+         struct resource_summary {
+            name                           owner;
+            asset                          net_weight;     /// totals staked to `owner` (userres)
+            asset                          cpu_weight;
+            int64_t                        ram_bytes;
+            std::vector<delegation_entry>  delegated;      /// stakes from `owner` (delband), one page
+            name                           more;           /// lower bound of the next delband page, empty if none
+            asset                          refund_amount;  /// pending refund, zero if none
+            time_point_sec                 refund_time;
+         };
+
+         /**
+          *  `owner`'s combined userres, delband and refund state.
+          *  Delegations are paged from `to` = `lower_bound`, at most `limit` per call.
+          */
+         [[eosio::action]]
+         resource_summary getresources( name owner, name lower_bound, uint32_t limit );
+
          /// functions defined in voting.cpp
          [[eosio::action]] /// unchanged for compatibility of eosio community related software apis
          void regproducer( const name producer, const public_key& producer_key, const std::string& url, uint16_t location );
@@ -291,6 +402,72 @@ namespace eosiosystem {
          [[eosio::action]]
          void voteproducer( const name voter, const name proxy, const std::vector<name>& producers );
 
+         struct producer_entry {
+            name          owner;
+            double        total_vote_weight;
+            int64_t       company_votes;
+            int64_t       government_votes;
+            int64_t       normal_votes;
+            std::string   url;
+            uint16_t      location;
+         };
+
+         struct producer_page {
+            std::vector<producer_entry>  producers;
+            name                         more;      /// lower bound of the next page, empty if none
+         };
+
+         struct voter_summary {
+            name               owner;
+            name               type;       /// account type the votes are weighted by, empty if not registered
+            std::vector<name>  producers;
+            int64_t            staked;
+         };
+
+         /**
+          *  Query actions (getproducers, getvoter, getresources) return their result as the action
+          *  return value, read from the trace of a read-only transaction.
+          */
+
+         /**
+          *  Active producers ranked by vote weight through the `prototalvote` index, at most `limit`
+          *  starting at producer `lower_bound` (the first one when empty).
+          */
+         [[eosio::action]]
+         producer_page getproducers( name lower_bound, uint32_t limit );
+
+         /**
+          *  With `max_per_location` > 0 the producer schedule takes at most that many producers from
+          *  each location, chosen by vote weight through the `prodlocs` table; 0 restores the plain
+          *  vote weight ranking. Values > 0 are rejected until indexprods has indexed every producer.
+          */
+         [[eosio::action]]
+         void setschedmode( uint16_t max_per_location );
+
+         /**
+          *  Adds producers registered before the `prodlocs` table existed to it, at most `limit` per
+          *  call, continuing where the previous call stopped.
+          */
+         [[eosio::action]]
+         void indexprods( uint32_t limit );
+
+         /**
+          *  Applies the stake changes accumulated by at most `max` ballots to the producers they vote
+          *  for. Anyone may call it; deferred changes reach the producers only through this action.
+          */
+         [[eosio::action]]
+         void tallyballots( uint32_t max );
+
+         /**
+          *  Moves the producer lists of at most `limit` voters, starting at `lower_bound`, that voted
+          *  before the `ballots` table existed from their voter row into a shared ballot.
+          */
+         [[eosio::action]]
+         void ballotvoters( name lower_bound, uint32_t limit );
+
+         [[eosio::action]]
+         voter_summary getvoter( name voter );
+
          [[eosio::action]]
          void setparams( const eosio::blockchain_parameters& params );
 
@@ -355,6 +532,15 @@ namespace eosiosystem {
 
          //defined in voting.cpp
          void update_elected_producers( block_timestamp timestamp );
+         std::vector<eosio::producer_key> top_producers_by_location( uint16_t max_per_location )const;
+         void update_producer_location( const producer_info& prod );
+         uint64_t acquire_ballot( const std::vector<name>& producers );
+         void release_ballot( uint64_t id );
+         std::vector<name> voter_producers( const voter_info& voter )const;
+         void add_ballot_stake( uint64_t ballot_id, name type, int64_t staked, int64_t pending );
+         bool defers_to_ballot( uint64_t ballot_id );
+         void apply_ballot( uint64_t ballot_id );
+         uint32_t tally_pending_ballots( uint32_t max );
          void update_producers_votes( name type, bool voting, const std::vector<name>& old_producers, int64_t old_staked,
                                       const std::vector<name>& new_producers, int64_t new_staked );
    };
@@ -12,6 +12,7 @@
 #include <eosiolib/transaction.hpp>
 
 #include <eosio.token/eosio.token.hpp>
+#include <common/row_cache.hpp>
 
 #include <cmath>
 #include <map>
@@ -21,6 +22,7 @@ namespace eosiosystem {
    using eosio::indexed_by;
    using eosio::const_mem_fun;
    using eosio::permission_level;
+   using eosio::row_cache;
    using eosio::time_point_sec;
    using std::map;
    using std::pair;
@@ -92,51 +94,54 @@ namespace eosiosystem {
       // update stake delegated from "from" to "receiver"
       {
          del_bandwidth_table     del_tbl( _self, from.value );
-         auto itr = del_tbl.find( receiver.value );
-         if( itr == del_tbl.end() ) {
-            itr = del_tbl.emplace( from, [&]( auto& dbo ){
-                  dbo.from          = from;
-                  dbo.to            = receiver;
-                  dbo.cpu_weight    = stake_cpu_delta;
+         row_cache<del_bandwidth_table> del_cache( del_tbl );
+         auto dbo = del_cache.find( receiver.value );
+         if( dbo == nullptr ) {
+            dbo = &del_cache.emplace( from, [&]( auto& d ){
+                  d.from          = from;
+                  d.to            = receiver;
+                  d.cpu_weight    = stake_cpu_delta;
             });
          } else {
-            del_tbl.modify( itr, same_payer, [&]( auto& dbo ){
-                  dbo.cpu_weight    += stake_cpu_delta;
+            del_cache.modify( *dbo, same_payer, [&]( auto& d ){
+                  d.cpu_weight    += stake_cpu_delta;
             });
          }
 
-         check( 0 <= itr->cpu_weight.amount, "insufficient staked cpu bandwidth" );
-         if ( itr->is_empty() ) {
-            del_tbl.erase( itr );
+         check( 0 <= dbo->cpu_weight.amount, "insufficient staked cpu bandwidth" );
+         if ( dbo->is_empty() ) {
+            del_cache.erase( *dbo );
          }
-      } // itr can be invalid, should go out of scope
+      } // del_cache flushes here, a row emptied by this call is erased without being rewritten first
 
       // update totals of "receiver"
       {
          user_resources_table   totals_tbl( _self, receiver.value );
-         auto tot_itr = totals_tbl.find( receiver.value );
-         if( tot_itr ==  totals_tbl.end() ) {
-            tot_itr = totals_tbl.emplace( from, [&]( auto& tot ) {
-                  tot.owner      = receiver;
-                  tot.cpu_weight = stake_cpu_delta;
+         row_cache<user_resources_table> totals_cache( totals_tbl );
+         auto tot = totals_cache.find( receiver.value );
+         if( tot == nullptr ) {
+            tot = &totals_cache.emplace( from, [&]( auto& t ) {
+                  t.owner      = receiver;
+                  t.cpu_weight = stake_cpu_delta;
             });
          } else {
-            totals_tbl.modify( tot_itr, from == receiver ? from : same_payer, [&]( auto& tot ) {
-                  tot.cpu_weight += stake_cpu_delta;
+            totals_cache.modify( *tot, from == receiver ? from : same_payer, [&]( auto& t ) {
+                  t.cpu_weight += stake_cpu_delta;
             });
          }
 
-         check( 0 <= tot_itr->cpu_weight.amount, "insufficient staked total cpu bandwidth" );
-         set_resource_limits_cpu( receiver.value, tot_itr->cpu_weight.amount );
-         if ( tot_itr->is_empty() ) {
-            totals_tbl.erase( tot_itr );
+         check( 0 <= tot->cpu_weight.amount, "insufficient staked total cpu bandwidth" );
+         set_resource_limits_cpu( receiver.value, tot->cpu_weight.amount );
+         if ( tot->is_empty() ) {
+            totals_cache.erase( *tot );
          }
-      } // tot_itr can be invalid, should go out of scope
+      } // totals_cache flushes here
 
       // create refund or update from existing refund
       if ( stake_account != source_stake_from ) { //for eosio both transfer and refund make no sense
          refunds_table refunds_tbl( _self, from.value );
-         auto req = refunds_tbl.find( from.value );
+         row_cache<refunds_table> refunds_cache( refunds_tbl );
+         auto req = refunds_cache.find( from.value );
 
          //create/update/delete refund
          auto cpu_balance = stake_cpu_delta;
@@ -147,8 +152,8 @@ namespace eosiosystem {
          bool is_delegating_to_self = (!transfer && from == receiver);
 
          if( is_delegating_to_self || is_undelegating ) {
-            if ( req != refunds_tbl.end() ) { //need to update refund
-               refunds_tbl.modify( req, same_payer, [&]( refund_request& r ) {
+            if ( req != nullptr ) { //need to update refund
+               refunds_cache.modify( *req, same_payer, [&]( refund_request& r ) {
                   if ( cpu_balance.amount < 0 ) {
                      r.request_time = current_time_point();
                   }
@@ -166,13 +171,13 @@ namespace eosiosystem {
                check( 0 <= req->cpu_amount.amount, "negative cpu refund amount" ); //should never happen
 
                if ( req->is_empty() ) {
-                  refunds_tbl.erase( req );
+                  refunds_cache.erase( *req );
                   need_deferred_trx = false;
                } else {
                   need_deferred_trx = true;
                }
             } else if ( cpu_balance.amount < 0 ) { //need to create refund
-               refunds_tbl.emplace( from, [&]( refund_request& r ) {
+               refunds_cache.emplace( from, [&]( refund_request& r ) {
                   r.owner = from;
                   r.cpu_amount = -cpu_balance;
                   cpu_balance.amount = 0;
@@ -181,6 +186,7 @@ namespace eosiosystem {
                need_deferred_trx = true;
             } // else stake increase requested with no existing row in refunds_tbl -> nothing to do with refunds_tbl
          } /// end if is_delegating_to_self || is_undelegating
+         refunds_cache.flush();
 
          if ( need_deferred_trx ) {
             eosio::transaction out;
@@ -227,10 +233,22 @@ namespace eosiosystem {
 
       check( 0 <= voter_itr->staked, "stake for voting cannot be negative" );
 
-      if( voter_itr->producers.size() ) {
+      // the producer list is only loaded when there are votes to re-tally
+      if( voter_itr->has_votes() ) {
           auto itr = _acntype.find( voter.value );
           if( itr != _acntype.end() ){
-             update_producers_votes( itr->type , false, voter_itr->producers, old_staked, voter_itr->producers, new_staked);
+             const int64_t  delta  = new_staked - old_staked;
+             const uint64_t ballot = voter_itr->ballot_id ? *voter_itr->ballot_id : 0;
+             if( ballot && defers_to_ballot( ballot ) ) {
+                // reaches the producers through the ballot, see tallyballots
+                add_ballot_stake( ballot, itr->type, delta, delta );
+             } else {
+                const auto producers = voter_producers( *voter_itr );
+                update_producers_votes( itr->type , false, producers, old_staked, producers, new_staked);
+                if( ballot ) {
+                   add_ballot_stake( ballot, itr->type, delta, 0 );
+                }
+             }
           }
       }
    }
@@ -284,5 +302,39 @@ namespace eosiosystem {
       refunds_tbl.erase( req );
    }
 
+   system_contract::resource_summary system_contract::getresources( name owner, name lower_bound, uint32_t limit ) {
+      check( limit <= 100, "limit must be in range [0, 100]" );
+
+      const asset zero_asset( 0, core_symbol() );
+      resource_summary summary{ owner, zero_asset, zero_asset, 0, {}, name{}, zero_asset, time_point_sec() };
+
+      user_resources_table totals_tbl( _self, owner.value );
+      auto totals = totals_tbl.find( owner.value );
+      if( totals != totals_tbl.end() ) {
+         summary.net_weight = totals->net_weight;
+         summary.cpu_weight = totals->cpu_weight;
+         summary.ram_bytes  = totals->ram_bytes;
+      }
+
+      del_bandwidth_table del_tbl( _self, owner.value );
+      auto dbw = del_tbl.lower_bound( lower_bound.value );
+      summary.delegated.reserve( limit );
+      for( ; dbw != del_tbl.end() && summary.delegated.size() < limit; ++dbw ) {
+         summary.delegated.push_back( delegation_entry{ dbw->to, dbw->net_weight, dbw->cpu_weight } );
+      }
+      if( dbw != del_tbl.end() ) {
+         summary.more = dbw->to;
+      }
+
+      refunds_table refunds_tbl( _self, owner.value );
+      auto req = refunds_tbl.find( owner.value );
+      if( req != refunds_tbl.end() ) {
+         summary.refund_amount = req->cpu_amount;
+         summary.refund_time   = req->request_time;
+      }
+
+      return summary;
+   }
+
 
 } //namespace eosiosystem
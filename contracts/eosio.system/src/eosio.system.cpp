@@ -93,6 +93,7 @@ namespace eosiosystem {
       _producers.modify( prod, same_payer, [&](auto& p) {
             p.deactivate();
       });
+      update_producer_location( *prod );
    }
 
 
@@ -236,9 +237,9 @@ EOSIO_DISPATCH( eosiosystem::system_contract,
      // eosio.system.cpp
      (init)(setparams)(setgrtdcpu)(setpriv)(setalimits)(rmvproducer)(buyram)(buyrambytes)(setvweight)(setacntfee)(setacntype)(awlset)
      // delegate_bandwidth.cpp
-     (delegatebw)(dlgtcpu)(undelegatebw)(undlgtcpu)(refund)
+     (delegatebw)(dlgtcpu)(undelegatebw)(undlgtcpu)(refund)(getresources)
      // voting.cpp
-     (regproducer)(unregprod)(voteproducer)
+     (regproducer)(unregprod)(voteproducer)(getproducers)(getvoter)(setschedmode)(indexprods)(tallyballots)(ballotvoters)
      // producer_pay.cpp
      (onblock)(claimrewards)
      //upgrade.cpp
@@ -6,6 +6,7 @@
 
 #include <eosiolib/eosio.hpp>
 #include <eosiolib/crypto.h>
+#include <eosiolib/crypto.hpp>
 #include <eosiolib/datastream.hpp>
 #include <eosiolib/serialize.hpp>
 #include <eosiolib/multi_index.hpp>
@@ -13,8 +14,10 @@
 #include <eosiolib/singleton.hpp>
 #include <eosiolib/transaction.hpp>
 #include <eosio.token/eosio.token.hpp>
+#include <common/row_cache.hpp>
 
 #include <algorithm>
+#include <iterator>
 #include <cmath>
 
 namespace eosiosystem {
@@ -22,6 +25,7 @@ namespace eosiosystem {
    using eosio::const_mem_fun;
    using eosio::singleton;
    using eosio::transaction;
+   using eosio::row_cache;
 
    void system_contract::regproducer( const name producer, const eosio::public_key& producer_key, const std::string& url, uint16_t location ) {
       check( url.size() < 512, "url too long" );
@@ -52,6 +56,7 @@ namespace eosiosystem {
          });
       }
 
+      update_producer_location( _producers.get( producer.value ) );
    }
 
    void system_contract::unregprod( const name producer ) {
@@ -61,6 +66,7 @@ namespace eosiosystem {
       _producers.modify( prod, same_payer, [&]( producer_info& info ){
          info.deactivate();
       });
+      update_producer_location( prod );
    }
 
    void system_contract::update_elected_producers( block_timestamp block_time ) {
@@ -71,8 +77,13 @@ namespace eosiosystem {
       std::vector< eosio::producer_key > top_producers;
       top_producers.reserve(21);
 
-      for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < 21 && 0 < it->total_vote_weight && it->active(); ++it ) {
-         top_producers.emplace_back( eosio::producer_key{it->owner, it->producer_key} );
+      const auto mode = schedule_mode_singleton( _self, _self.value ).get_or_default();
+      if ( mode.max_per_location > 0 ) {
+         top_producers = top_producers_by_location( mode.max_per_location );
+      } else {
+         for ( auto it = idx.cbegin(); it != idx.cend() && top_producers.size() < 21 && 0 < it->total_vote_weight && it->active(); ++it ) {
+            top_producers.emplace_back( eosio::producer_key{it->owner, it->producer_key} );
+         }
       }
 
       if ( top_producers.empty() || top_producers.size() < _gstate.last_producer_schedule_size ) {
@@ -92,6 +103,88 @@ namespace eosiosystem {
       }
    }
 
+   std::vector<eosio::producer_key> system_contract::top_producers_by_location( uint16_t max_per_location )const {
+      producer_locations_table locations( _self, _self.value );
+      auto idx = locations.get_index<"bylocation"_n>();
+
+      // the best `max_per_location` producers with votes of every location
+      std::vector<std::pair<double, const producer_info*>> candidates;
+      for ( auto it = idx.cbegin(); it != idx.cend(); ) {
+         const uint64_t location = static_cast<uint64_t>( it->location_key >> 64 );
+         for ( uint16_t taken = 0; it != idx.cend() && (it->location_key >> 64) == location && taken < max_per_location; ++it, ++taken ) {
+            const auto& prod = _producers.get( it->owner.value, "producer not found" );
+            if ( !(0 < prod.total_vote_weight) )
+               break;
+            candidates.emplace_back( prod.total_vote_weight, &prod );
+         }
+         it = idx.lower_bound( static_cast<uint128_t>(location + 1) << 64 );
+      }
+
+      const size_t count = std::min<size_t>( candidates.size(), 21 );
+      std::partial_sort( candidates.begin(), candidates.begin() + count, candidates.end(), []( const auto& a, const auto& b ) {
+         return a.first != b.first ? a.first > b.first : a.second->owner < b.second->owner;
+      });
+
+      std::vector<eosio::producer_key> top_producers;
+      top_producers.reserve( count );
+      for ( size_t i = 0; i < count; ++i ) {
+         top_producers.emplace_back( eosio::producer_key{ candidates[i].second->owner, candidates[i].second->producer_key } );
+      }
+      return top_producers;
+   }
+
+   void system_contract::update_producer_location( const producer_info& prod ) {
+      producer_locations_table locations( _self, _self.value );
+      auto itr = locations.find( prod.owner.value );
+      if ( !prod.active() ) {
+         if ( itr != locations.end() )
+            locations.erase( itr );
+         return;
+      }
+
+      const uint128_t key = make_location_key( prod.location, prod.total_vote_weight );
+      if ( itr == locations.end() ) {
+         locations.emplace( _self, [&]( auto& l ) {
+            l.owner        = prod.owner;
+            l.location_key = key;
+         });
+      } else if ( itr->location_key != key ) {
+         locations.modify( itr, same_payer, [&]( auto& l ) {
+            l.location_key = key;
+         });
+      }
+   }
+
+   void system_contract::setschedmode( uint16_t max_per_location ) {
+      require_auth( _self );
+
+      schedule_mode_singleton modes( _self, _self.value );
+      auto mode = modes.get_or_default();
+      check( max_per_location == 0 || mode.indexed, "run indexprods over every producer first" );
+      mode.max_per_location = max_per_location;
+      modes.set( mode, _self );
+   }
+
+   void system_contract::indexprods( uint32_t limit ) {
+      check( 0 < limit && limit <= 100, "limit must be in range [1, 100]" );
+
+      schedule_mode_singleton modes( _self, _self.value );
+      auto mode = modes.get_or_default();
+      check( !mode.indexed, "every producer is indexed" );
+
+      // producers registered or voted for meanwhile are indexed already, indexing them again writes nothing
+      auto it = _producers.lower_bound( mode.next_indexed.value );
+      for ( uint32_t i = 0; it != _producers.end() && i < limit; ++it, ++i ) {
+         update_producer_location( *it );
+      }
+      if ( it == _producers.end() ) {
+         mode.indexed = true;
+      } else {
+         mode.next_indexed = it->owner;
+      }
+      modes.set( mode, _self );
+   }
+
    void system_contract::voteproducer( const name voter_name, const name , const std::vector<name>& producers ) {
       require_auth( voter_name );
       check( producers.size() <= 30, "attempt to vote for too many producers" );
@@ -105,58 +198,262 @@ namespace eosiosystem {
       auto itr = _acntype.find( voter_name.value );
       check( itr != _acntype.end(), "user must registered as company or government");
 
-      auto old_producers = voter_itr->producers;
-      auto old_staked    = voter_itr->staked;
-      auto new_producers = producers;
-      auto new_staked    = voter_itr->staked;
-      auto a_type        = itr->type;
+      const auto old_producers = voter_producers( *voter_itr );
+      const auto staked        = voter_itr->staked;
+      const auto old_ballot    = voter_itr->ballot_id ? *voter_itr->ballot_id : 0;
+
+      // the tallies must hold the old ballot's pending changes before this voter's stake leaves it
+      if( old_ballot ) {
+         apply_ballot( old_ballot );
+         add_ballot_stake( old_ballot, itr->type, -staked, 0 );
+      }
+
+      // taken before the old one is released, so an unchanged ballot is not erased and recreated
+      const uint64_t new_ballot = producers.empty() ? 0 : acquire_ballot( producers );
+      if( new_ballot ) {
+         add_ballot_stake( new_ballot, itr->type, staked, 0 );
+      }
+      if( old_ballot ) {
+         release_ballot( old_ballot );
+      }
 
       _voters.modify( voter_itr, same_payer, [&]( auto& v ) {
-         v.producers = new_producers;
+         v.producers.clear();
+         v.ballot_id.emplace( new_ballot );
       });
 
-      update_producers_votes( a_type, true, old_producers, old_staked, new_producers, new_staked );
+      update_producers_votes( itr->type, true, old_producers, staked, producers, staked );
+   }
+
+   system_contract::producer_page system_contract::getproducers( name lower_bound, uint32_t limit ) {
+      check( 0 < limit && limit <= 100, "limit must be in range [1, 100]" );
+
+      auto idx = _producers.get_index<"prototalvote"_n>();
+      auto it = lower_bound ? idx.iterator_to( _producers.get( lower_bound.value, "producer not found" ) ) : idx.begin();
+
+      // inactive producers with votes sort after every active one, inactive producers without
+      // votes tie with active ones without votes and are skipped
+      auto listed = [&]( const producer_info& p ) { return p.active() || p.total_vote_weight <= 0; };
+      const uint32_t max_scanned = 1000;
+
+      producer_page page;
+      page.producers.reserve( limit );
+      for( uint32_t scanned = 0; it != idx.end() && listed( *it ) && page.producers.size() < limit && scanned < max_scanned; ++it, ++scanned ) {
+         if( it->active() ) {
+            page.producers.push_back( producer_entry{ it->owner, it->total_vote_weight, it->company_votes, it->government_votes,
+                                                      it->normal_votes, it->url, it->location } );
+         }
+      }
+      if( it != idx.end() && listed( *it ) ) {
+         page.more = it->owner;
+      }
+      return page;
+   }
+
+   system_contract::voter_summary system_contract::getvoter( name voter ) {
+      const auto& v = _voters.get( voter.value, "voter not found" );
+      auto type_itr = _acntype.find( voter.value );
+
+      return voter_summary{ v.owner, type_itr != _acntype.end() ? type_itr->type : name{}, voter_producers( v ), v.staked };
+   }
+
+   uint64_t system_contract::acquire_ballot( const std::vector<name>& producers ) {
+      ballots_table ballots( _self, _self.value );
+
+      const auto packed = pack( producers );
+      const auto hash   = sha256( packed.data(), packed.size() ).extract_as_byte_array();
+      uint64_t id;
+      memcpy( &id, hash.data(), sizeof(id) );
+
+      // probing stops at the first free id, so a list stored behind an erased ballot may be stored twice
+      for( id = std::max<uint64_t>( id, 1 ); ; ++id ) {
+         auto itr = ballots.find( id );
+         if( itr == ballots.end() ) {
+            ballots.emplace( _self, [&]( auto& b ) {
+               b.id        = id;
+               b.producers = producers;
+               b.refs      = 1;
+            });
+            return id;
+         }
+         if( itr->producers == producers ) {
+            ballots.modify( itr, same_payer, [&]( auto& b ) {
+               ++b.refs;
+            });
+            return id;
+         }
+      }
+   }
+
+   void system_contract::release_ballot( uint64_t id ) {
+      ballots_table ballots( _self, _self.value );
+      const auto& b = ballots.get( id, "ballot not found" );
+      if( b.refs > 1 ) {
+         ballots.modify( b, same_payer, [&]( auto& r ) {
+            --r.refs;
+         });
+      } else {
+         ballots.erase( b );
+
+         ballot_stakes_table stakes( _self, _self.value );
+         auto stake = stakes.find( id );
+         if( stake != stakes.end() ) {
+            stakes.erase( stake );
+         }
+      }
+   }
+
+   void system_contract::add_ballot_stake( uint64_t ballot_id, name type, int64_t staked, int64_t pending ) {
+      ballot_stakes_table stakes( _self, _self.value );
+      auto update = [&]( auto& s ) {
+         if( !s.has_pending() && pending ) {
+            s.pending_since = current_time_point().time_since_epoch().count();
+         }
+         s.ballot_id = ballot_id;
+         if ( type == name_company ) {
+            s.company_staked  += staked;
+            s.company_pending += pending;
+         } else {
+            s.government_staked  += staked;
+            s.government_pending += pending;
+         }
+      };
+
+      auto itr = stakes.find( ballot_id );
+      if( itr == stakes.end() ) {
+         stakes.emplace( _self, update );
+      } else {
+         stakes.modify( itr, same_payer, update );
+      }
+   }
+
+   bool system_contract::defers_to_ballot( uint64_t ballot_id ) {
+      // a voter alone on its ballot gains nothing from deferring
+      ballots_table ballots( _self, _self.value );
+      return ballots.get( ballot_id, "ballot not found" ).refs >= 2;
+   }
+
+   void system_contract::apply_ballot( uint64_t ballot_id ) {
+      ballot_stakes_table stakes( _self, _self.value );
+      auto itr = stakes.find( ballot_id );
+      if( itr == stakes.end() || !itr->has_pending() ) {
+         return;
+      }
+
+      ballots_table ballots( _self, _self.value );
+      const std::vector<name> none;
+      const auto& producers = ballots.get( ballot_id, "ballot not found" ).producers;
+      if( itr->company_pending ) {
+         update_producers_votes( name_company, false, none, 0, producers, itr->company_pending );
+      }
+      if( itr->government_pending ) {
+         update_producers_votes( name_government, false, none, 0, producers, itr->government_pending );
+      }
+
+      stakes.modify( itr, same_payer, [&]( auto& s ) {
+         s.company_pending    = 0;
+         s.government_pending = 0;
+         s.pending_since      = 0;
+      });
+   }
+
+   uint32_t system_contract::tally_pending_ballots( uint32_t max ) {
+      ballot_stakes_table stakes( _self, _self.value );
+      auto idx = stakes.get_index<"bypending"_n>();
+
+      uint32_t applied = 0;
+      // oldest pending change first; applying a ballot moves it to the end of the index
+      for( auto it = idx.begin(); it != idx.end() && it->has_pending() && applied < max; it = idx.begin(), ++applied ) {
+         apply_ballot( it->ballot_id );
+      }
+      return applied;
+   }
+
+   void system_contract::tallyballots( uint32_t max ) {
+      check( 0 < max && max <= 100, "max must be in range [1, 100]" );
+
+      tally_pending_ballots( max );
+   }
+
+   void system_contract::ballotvoters( name lower_bound, uint32_t limit ) {
+      check( 0 < limit && limit <= 100, "limit must be in range [1, 100]" );
+
+      auto it = _voters.lower_bound( lower_bound.value );
+      for ( uint32_t i = 0; it != _voters.end() && i < limit; ++it, ++i ) {
+         if( it->producers.empty() ) {
+            continue;
+         }
+         auto type_itr = _acntype.find( it->owner.value );
+         if( type_itr == _acntype.end() ) {
+            continue;
+         }
+
+         // same producers and stake, so the producers' tallies stay as they are
+         const uint64_t id = acquire_ballot( it->producers );
+         add_ballot_stake( id, type_itr->type, it->staked, 0 );
+         _voters.modify( it, same_payer, [&]( auto& v ) {
+            v.producers.clear();
+            v.ballot_id.emplace( id );
+         });
+      }
+   }
+
+   std::vector<name> system_contract::voter_producers( const voter_info& voter )const {
+      if( !voter.ballot_id || !*voter.ballot_id ) {
+         return voter.producers;
+      }
+      ballots_table ballots( _self, _self.value );
+      return ballots.get( *voter.ballot_id, "ballot not found" ).producers;
    }
 
    void system_contract::update_producers_votes( name a_type, bool voting,
                                                  const std::vector<name>& old_producers, int64_t old_staked,
                                                  const std::vector<name>& new_producers, int64_t new_staked ) {
-      if( old_staked != 0){
-          for( const auto& p : old_producers  ) {
-             auto pitr = _producers.find( p.value );
-             check( !voting || pitr->active(), "producer is not currently registered" );
-             if ( a_type == name_company ){
-                _producers.modify( pitr, same_payer, [&]( auto& p ) {
-                   p.company_votes -= old_staked;
-                });
-             } else {
-               _producers.modify( pitr, same_payer, [&]( auto& p ) {
-                   p.government_votes -= old_staked;
-               });
-             }
-            _producers.modify( pitr, same_payer, [&]( auto& p ) {
-               p.total_vote_weight = p.government_votes * _vwstate.government_weight + p.company_votes * _vwstate.company_weight;
-            });
-          }
+      // a producer present in both lists is decoded and written back only once
+      row_cache<producers_table> producers( _producers );
+
+      // both lists are sorted, voteproducer checks it
+      std::vector<name> changed;
+      std::set_union( old_producers.begin(), old_producers.end(), new_producers.begin(), new_producers.end(),
+                      std::back_inserter( changed ) );
+      std::vector<uint128_t> old_keys;
+      old_keys.reserve( changed.size() );
+      for( const auto& p : changed ) {
+         const auto& prod = producers.get( p.value, "producer not found" );
+         old_keys.push_back( make_location_key( prod.location, prod.total_vote_weight ) );
       }
 
-      if ( new_staked != 0 ){
-          for( const auto& p : new_producers  ) {
-               auto pitr = _producers.find( p.value );
-               check( !voting || pitr->active(), "producer is not currently registered" );
-               if ( a_type == name_company ){
-                  _producers.modify( pitr, same_payer, [&]( auto& p ) {
-                     p.company_votes += new_staked;
-                  });
+      auto apply_votes = [&]( const std::vector<name>& voted, int64_t delta ) {
+         for( const auto& p : voted ) {
+            const auto& prod = producers.get( p.value, "producer not found" );
+            check( !voting || prod.active(), "producer is not currently registered" );
+            producers.modify( prod, same_payer, [&]( auto& info ) {
+               if ( a_type == name_company ) {
+                  info.company_votes += delta;
                } else {
-                 _producers.modify( pitr, same_payer, [&]( auto& p ) {
-                     p.government_votes += new_staked;
-                 });
+                  info.government_votes += delta;
                }
-               _producers.modify( pitr, same_payer, [&]( auto& p ) {
-                  p.total_vote_weight = p.government_votes * _vwstate.government_weight + p.company_votes * _vwstate.company_weight;
-               });
-          }
+               info.total_vote_weight = info.government_votes * _vwstate.government_weight + info.company_votes * _vwstate.company_weight;
+            });
+         }
+      };
+
+      if( old_staked != 0 ) {
+         apply_votes( old_producers, -old_staked );
+      }
+
+      if( new_staked != 0 ) {
+         apply_votes( new_producers, new_staked );
       }
+
+      // prodlocs is only touched for producers whose key moved; equal old and new stake leaves it alone
+      for( size_t i = 0; i < changed.size(); ++i ) {
+         const auto& prod = producers.get( changed[i].value, "producer not found" );
+         if( make_location_key( prod.location, prod.total_vote_weight ) != old_keys[i] ) {
+            update_producer_location( prod );
+         }
+      }
+
+      producers.flush();
    }
 } /// namespace eosiosystem
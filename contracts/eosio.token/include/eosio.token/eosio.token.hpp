@@ -6,8 +6,13 @@
 
 #include <eosiolib/asset.hpp>
 #include <eosiolib/eosio.hpp>
+#include <eosiolib/singleton.hpp>
+#include <eosiolib/time.hpp>
 
+#include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace eosiosystem {
    class system_contract;
@@ -21,6 +26,23 @@ namespace eosio {
       public:
          using contract::contract;
 
+         ~token();
+
+         struct recipient {
+            name     to;
+            asset    quantity;
+         };
+
+         struct balance_entry {
+            name     owner;
+            asset    balance;
+         };
+
+         struct holder_page {
+            std::vector<balance_entry> entries;
+            name                       more;
+         };
+
          [[eosio::action]]
          void create( name   issuer,
                       asset  maximum_supply);
@@ -28,6 +50,13 @@ namespace eosio {
          [[eosio::action]]
          void issue( name to, asset quantity, string memo );
 
+         /**
+          *  Issues to many accounts in one action. Supply is updated once and recipients are
+          *  credited directly, new balance rows are paid by the issuer.
+          */
+         [[eosio::action]]
+         void issuebatch( const std::vector<std::pair<name, asset>>& issues, string memo );
+
          [[eosio::action]]
          void retire( asset quantity, string memo );
 
@@ -37,12 +66,43 @@ namespace eosio {
                         asset   quantity,
                         string  memo );
 
+         /**
+          *  Transfers to many recipients in one action. All quantities must share one symbol;
+          *  `from` is debited once with the sum and every distinct recipient is credited once
+          *  with its grouped amount and notified once.
+          */
+         [[eosio::action]]
+         void transferbatch( name                            from,
+                             const std::vector<recipient>&   recipients,
+                             string                          memo );
+
          [[eosio::action]]
          void open( name owner, const symbol& symbol, name ram_payer );
 
          [[eosio::action]]
          void close( name owner, const symbol& symbol );
 
+         /**
+          *  Balance queries. The result is the action return value, so clients read many balances
+          *  from the trace of one read-only transaction instead of issuing one table query per account.
+          *  Missing balance rows are reported as zero.
+          */
+         [[eosio::action]]
+         std::vector<balance_entry> getbalances( const std::vector<std::pair<name, symbol_code>>& owners );
+
+         /**
+          *  Pages through the holders of `sym` starting at `lower_bound`, at most `limit` entries.
+          *  `more` in the result is the lower bound of the next page, or empty after the last holder.
+          */
+         [[eosio::action]]
+         holder_page getholders( symbol_code sym, name lower_bound, uint32_t limit );
+
+         /**
+          *  Adds a balance row created before the holder index existed to that index, billed to `ram_payer`.
+          */
+         [[eosio::action]]
+         void indexholder( name owner, const symbol& symbol, name ram_payer );
+
          static asset get_supply( name token_contract_account, symbol_code sym_code )
          {
             stats statstable( token_contract_account, sym_code.raw() );
@@ -59,10 +119,15 @@ namespace eosio {
 
          using create_action = eosio::action_wrapper<"create"_n, &token::create>;
          using issue_action = eosio::action_wrapper<"issue"_n, &token::issue>;
+         using issuebatch_action = eosio::action_wrapper<"issuebatch"_n, &token::issuebatch>;
          using retire_action = eosio::action_wrapper<"retire"_n, &token::retire>;
          using transfer_action = eosio::action_wrapper<"transfer"_n, &token::transfer>;
+         using transferbatch_action = eosio::action_wrapper<"transferbatch"_n, &token::transferbatch>;
          using open_action = eosio::action_wrapper<"open"_n, &token::open>;
          using close_action = eosio::action_wrapper<"close"_n, &token::close>;
+         using getbalances_action = eosio::action_wrapper<"getbalances"_n, &token::getbalances>;
+         using getholders_action = eosio::action_wrapper<"getholders"_n, &token::getholders>;
+         using indexholder_action = eosio::action_wrapper<"indexholder"_n, &token::indexholder>;
       private:
          struct [[eosio::table]] account {
             asset    balance;
@@ -78,11 +143,54 @@ namespace eosio {
             uint64_t primary_key()const { return supply.symbol.code().raw(); }
          };
 
+         /**
+          *  Balance change log, one `changeseq` singleton and one `balchanges` ring buffer per symbol
+          *  (scope is the symbol code). Every balance change gets the next sequence number and is
+          *  stored in slot `seq % balance_change_window`, so indexers can poll the changes since the
+          *  last sequence they have seen instead of rescanning `accounts`. A gap between the last seen
+          *  sequence and the oldest sequence in the window means a full resync is required.
+          */
+         static constexpr uint64_t balance_change_window = 4096;
+
+         struct [[eosio::table("changeseq")]] change_seq {
+            uint64_t    next = 0;   /// sequence number of the next balance change
+         };
+
+         struct [[eosio::table("balchanges")]] balance_change {
+            uint64_t          seq;
+            name              owner;
+            asset             balance;   /// balance after the change
+            time_point_sec    time;
+
+            uint64_t primary_key()const { return seq % balance_change_window; }
+         };
+
+         /**
+          *  Accounts holding a balance row of a symbol (scope is the symbol code), kept so holders
+          *  can be paged by getholders; `accounts` itself is scoped by owner. Each row is billed
+          *  to the payer of the matching balance row and erased by close.
+          */
+         struct [[eosio::table]] holder {
+            name     owner;
+
+            uint64_t primary_key()const { return owner.value; }
+         };
+
          typedef eosio::multi_index< "accounts"_n, account > accounts;
+         typedef eosio::multi_index< "holders"_n, holder > holders;
          typedef eosio::multi_index< "stat"_n, currency_stats > stats;
+         typedef eosio::singleton< "changeseq"_n, change_seq > change_seq_singleton;
+         typedef eosio::multi_index< "balchanges"_n, balance_change > balance_changes;
+
+         /// next sequence number per symbol code, loaded lazily and saved once by the destructor
+         std::map<uint64_t, uint64_t> _next_change_seq;
+
+         static time_point current_time_point();
 
          void sub_balance( name owner, asset value );
          void add_balance( name owner, asset value, name ram_payer );
+         void record_change( name owner, const asset& balance );
+         void add_holder( name owner, symbol_code sym, name ram_payer );
    };
 
 } /// namespace eosio
@@ -5,8 +5,20 @@
 
 #include <eosio.token/eosio.token.hpp>
 
+#include <eosiolib/system.h>
+
+#include <map>
+
 namespace eosio {
 
+token::~token()
+{
+   for( const auto& s : _next_change_seq ) {
+      change_seq_singleton seq( _self, s.first );
+      seq.set( change_seq{ s.second }, _self );
+   }
+}
+
 void token::create( name   issuer,
                     asset  maximum_supply )
 {
@@ -60,6 +72,50 @@ void token::issue( name to, asset quantity, string memo )
     }
 }
 
+void token::issuebatch( const std::vector<std::pair<name, asset>>& issues, string memo )
+{
+    check( !issues.empty(), "nothing to issue" );
+    check( memo.size() <= 256, "memo has more than 256 bytes" );
+
+    auto sym = issues.front().second.symbol;
+    check( sym.is_valid(), "invalid symbol name" );
+
+    stats statstable( _self, sym.code().raw() );
+    auto existing = statstable.find( sym.code().raw() );
+    check( existing != statstable.end(), "token with symbol does not exist, create token before issue" );
+    const auto& st = *existing;
+
+    require_auth( st.issuer );
+
+    std::map<name, int64_t> credits;
+    int64_t total = 0;
+    for( const auto& i : issues ) {
+       const auto& quantity = i.second;
+       check( quantity.is_valid(), "invalid quantity" );
+       check( quantity.amount > 0, "must issue positive quantity" );
+       check( quantity.symbol == st.supply.symbol, "symbol precision mismatch" );
+
+       total += quantity.amount;
+       check( total <= st.max_supply.amount - st.supply.amount, "quantity exceeds available supply");
+       credits[i.first] += quantity.amount;
+    }
+
+    for( const auto& c : credits ) {
+       check( is_account( c.first ), "to account does not exist" );
+    }
+
+    statstable.modify( st, same_payer, [&]( auto& s ) {
+       s.supply.amount += total;
+    });
+
+    for( const auto& c : credits ) {
+       if( c.first != st.issuer ) {
+          require_recipient( c.first );
+       }
+       add_balance( c.first, asset( c.second, sym ), st.issuer );
+    }
+}
+
 void token::retire( asset quantity, string memo )
 {
     auto sym = quantity.symbol;
@@ -110,6 +166,45 @@ void token::transfer( name    from,
    add_balance(to, quantity, payer);
 }
 
+void token::transferbatch( name                            from,
+                           const std::vector<recipient>&   recipients,
+                           string                          memo )
+{
+   require_auth(from);
+   check(!recipients.empty(), "no recipients");
+   check(memo.size() <= 256, "memo has more than 256 bytes");
+
+   const auto sym = recipients.front().quantity.symbol;
+   stats statstable(_self, sym.code().raw());
+   const auto &st = statstable.get(sym.code().raw());
+   check(sym == st.supply.symbol, "symbol precision mismatch");
+
+   // group by recipient so that each account row is written and notified once
+   std::map<name, int64_t> credits;
+   int64_t total = 0;
+   for( const auto& r : recipients ) {
+      check(r.to != from, "cannot transfer to self");
+      check(r.quantity.is_valid(), "invalid quantity");
+      check(r.quantity.amount > 0, "must transfer positive quantity");
+      check(r.quantity.symbol == sym, "all quantities must have the same symbol");
+
+      total += r.quantity.amount;
+      check(total <= asset::max_amount, "batch total overflow");
+      credits[r.to] += r.quantity.amount;
+   }
+
+   require_recipient(from);
+   for( const auto& c : credits ) {
+      check(is_account(c.first), "to account does not exist");
+      require_recipient(c.first);
+   }
+
+   sub_balance(from, asset(total, sym));
+   for( const auto& c : credits ) {
+      add_balance(c.first, asset(c.second, sym), has_auth(c.first) ? c.first : from);
+   }
+}
+
 void token::sub_balance( name owner, asset value ) {
    accounts from_acnts( _self, owner.value );
 
@@ -119,6 +214,8 @@ void token::sub_balance( name owner, asset value ) {
    from_acnts.modify( from, owner, [&]( auto& a ) {
          a.balance -= value;
       });
+
+   record_change( owner, from.balance );
 }
 
 void token::add_balance( name owner, asset value, name ram_payer )
@@ -126,14 +223,44 @@ void token::add_balance( name owner, asset value, name ram_payer )
    accounts to_acnts( _self, owner.value );
    auto to = to_acnts.find( value.symbol.code().raw() );
    if( to == to_acnts.end() ) {
-      to_acnts.emplace( ram_payer, [&]( auto& a ){
+      to = to_acnts.emplace( ram_payer, [&]( auto& a ){
         a.balance = value;
       });
+      add_holder( owner, value.symbol.code(), ram_payer );
    } else {
       to_acnts.modify( to, same_payer, [&]( auto& a ) {
         a.balance += value;
       });
    }
+
+   record_change( owner, to->balance );
+}
+
+void token::record_change( name owner, const asset& balance )
+{
+   const auto sym_code_raw = balance.symbol.code().raw();
+
+   auto next = _next_change_seq.find( sym_code_raw );
+   if( next == _next_change_seq.end() ) {
+      change_seq_singleton seq( _self, sym_code_raw );
+      next = _next_change_seq.emplace( sym_code_raw, seq.get_or_default().next ).first;
+   }
+   const uint64_t seq = next->second++;
+
+   auto fill = [&]( auto& c ) {
+      c.seq     = seq;
+      c.owner   = owner;
+      c.balance = balance;
+      c.time    = time_point_sec( current_time_point() );
+   };
+
+   balance_changes changes( _self, sym_code_raw );
+   auto slot = changes.find( seq % balance_change_window );
+   if( slot == changes.end() ) {
+      changes.emplace( _self, fill );
+   } else {
+      changes.modify( slot, same_payer, fill );
+   }
 }
 
 void token::open( name owner, const symbol& symbol, name ram_payer )
@@ -152,6 +279,8 @@ void token::open( name owner, const symbol& symbol, name ram_payer )
       acnts.emplace( ram_payer, [&]( auto& a ){
         a.balance = asset{0, symbol};
       });
+      add_holder( owner, symbol.code(), ram_payer );
+      record_change( owner, asset{0, symbol} );
    }
 }
 
@@ -162,9 +291,88 @@ void token::close( name owner, const symbol& symbol )
    auto it = acnts.find( symbol.code().raw() );
    check( it != acnts.end(), "Balance row already deleted or never existed. Action won't have any effect." );
    check( it->balance.amount == 0, "Cannot close because the balance is not zero." );
+   // the zero balance tells indexers that owner no longer holds a balance row of this symbol
+   record_change( owner, it->balance );
    acnts.erase( it );
+
+   holders holdertable( _self, symbol.code().raw() );
+   auto h = holdertable.find( owner.value );
+   if( h != holdertable.end() ) {
+      holdertable.erase( h );
+   }
+}
+
+void token::add_holder( name owner, symbol_code sym, name ram_payer )
+{
+   holders holdertable( _self, sym.raw() );
+   if( holdertable.find( owner.value ) == holdertable.end() ) {
+      holdertable.emplace( ram_payer, [&]( auto& h ){
+        h.owner = owner;
+      });
+   }
+}
+
+void token::indexholder( name owner, const symbol& symbol, name ram_payer )
+{
+   require_auth( ram_payer );
+
+   accounts acnts( _self, owner.value );
+   const auto& ac = acnts.get( symbol.code().raw(), "no balance object found" );
+   check( ac.balance.symbol == symbol, "symbol precision mismatch" );
+
+   add_holder( owner, symbol.code(), ram_payer );
+}
+
+std::vector<token::balance_entry> token::getbalances( const std::vector<std::pair<name, symbol_code>>& owners )
+{
+   check( !owners.empty(), "no owners" );
+   check( owners.size() <= 1000, "too many owners" );
+
+   std::map<uint64_t, symbol> symbols;
+   std::vector<balance_entry> entries;
+   entries.reserve( owners.size() );
+   for( const auto& o : owners ) {
+      const auto sym_code_raw = o.second.raw();
+      auto sym = symbols.find( sym_code_raw );
+      if( sym == symbols.end() ) {
+         stats statstable( _self, sym_code_raw );
+         const auto& st = statstable.get( sym_code_raw, "symbol does not exist" );
+         sym = symbols.emplace( sym_code_raw, st.supply.symbol ).first;
+      }
+
+      accounts acnts( _self, o.first.value );
+      auto it = acnts.find( sym_code_raw );
+      entries.push_back( balance_entry{ o.first, it != acnts.end() ? it->balance : asset{0, sym->second} } );
+   }
+   return entries;
+}
+
+token::holder_page token::getholders( symbol_code sym, name lower_bound, uint32_t limit )
+{
+   check( 0 < limit && limit <= 1000, "limit must be in range [1, 1000]" );
+
+   stats statstable( _self, sym.raw() );
+   statstable.get( sym.raw(), "symbol does not exist" );
+
+   holders holdertable( _self, sym.raw() );
+   holder_page page;
+   page.entries.reserve( limit );
+   auto h = holdertable.lower_bound( lower_bound.value );
+   for( ; h != holdertable.end() && page.entries.size() < limit; ++h ) {
+      accounts acnts( _self, h->owner.value );
+      page.entries.push_back( balance_entry{ h->owner, acnts.get( sym.raw() ).balance } );
+   }
+   if( h != holdertable.end() ) {
+      page.more = h->owner;
+   }
+   return page;
+}
+
+time_point token::current_time_point() {
+   const static time_point ct{ microseconds{ static_cast<int64_t>( current_time() ) } };
+   return ct;
 }
 
 } /// namespace eosio
 
-EOSIO_DISPATCH( eosio::token, (create)(issue)(transfer)(open)(close)(retire) )
+EOSIO_DISPATCH( eosio::token, (create)(issue)(issuebatch)(transfer)(transferbatch)(open)(close)(retire)(getbalances)(getholders)(indexholder) )
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+
+namespace eosio { namespace hashed {
+
+  /**
+   * Open addressing over the primary key of a multi_index style table: a row lives in the
+   * first free slot at or after its home slot, and every probe run is free of holes.
+   */
+
+  /**
+   * Probes from `home` until `matches(row)` holds or a free slot is reached. Returns the row if
+   * present, and the slot it occupies or would occupy.
+   */
+  template<typename Table, typename Matches>
+  std::pair<typename Table::const_iterator, uint64_t> find(const Table& table, uint64_t home, Matches matches){
+    for( uint64_t slot = home; ; ++slot ){
+      auto iterator = table.find(slot);
+      if( iterator == table.end() || matches(*iterator) ){
+        return { iterator, slot };
+      }
+    }
+  }
+
+  template<typename Table, typename Payer, typename Row>
+  void insert(Table& table, Payer payer, uint64_t slot, const Row& row){
+    table.emplace(payer, [&](auto& r){
+      r = row;
+      r.pkey = slot;
+    });
+  }
+
+  /**
+   * Erases a row and shifts later rows of the same probe run back, so find never stops at a
+   * hole in front of a row it is looking for. `home_of(row)` gives the home slot of a row.
+   */
+  template<typename Table, typename Payer, typename HomeOf>
+  void erase(Table& table, Payer payer, typename Table::const_iterator iterator, HomeOf home_of){
+    uint64_t hole = iterator->primary_key();
+    table.erase(iterator);
+
+    for( uint64_t slot = hole + 1; ; ++slot ){
+      auto next = table.find(slot);
+      if( next == table.end() ){
+        return;
+      }
+      // the row may fill the hole unless the hole lies before its home slot
+      if( slot - home_of(*next) >= slot - hole ){
+        auto row = *next;
+        table.erase(next);
+        insert(table, payer, hole, row);
+        hole = slot;
+      }
+    }
+  }
+
+} } /// namespace eosio::hashed
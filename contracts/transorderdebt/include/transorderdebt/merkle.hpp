@@ -0,0 +1,68 @@
+#pragma once
+#include <eosio/crypto.hpp>
+#include <eosio/datastream.hpp>
+
+#include <cstring>
+#include <vector>
+
+namespace eosio { namespace merkle {
+
+  /**
+   * Binary Merkle tree over sha256 with domain separated leaves and nodes:
+   *   leaf = sha256(0x00 || packed record)
+   *   node = sha256(0x01 || left || right)
+   * The last node of a level with an odd count moves up unchanged.
+   */
+  template<typename T>
+  checksum256 leaf_hash(const T& record){
+    std::vector<char> buffer(1 + pack_size(record));
+    buffer[0] = 0;
+    datastream<char*> ds(buffer.data() + 1, buffer.size() - 1);
+    ds << record;
+    return sha256(buffer.data(), buffer.size());
+  }
+
+  inline checksum256 node_hash(const checksum256& left, const checksum256& right){
+    char buffer[65];
+    buffer[0] = 1;
+    const auto l = left.extract_as_byte_array();
+    const auto r = right.extract_as_byte_array();
+    memcpy(buffer + 1, l.data(), 32);
+    memcpy(buffer + 33, r.data(), 32);
+    return sha256(buffer, sizeof(buffer));
+  }
+
+  inline checksum256 root(std::vector<checksum256> nodes){
+    check( !nodes.empty(), "empty merkle tree" );
+    while( nodes.size() > 1 ){
+      size_t next = 0;
+      for( size_t i = 0; i < nodes.size(); i += 2 ){
+        nodes[next++] = i + 1 < nodes.size() ? node_hash(nodes[i], nodes[i + 1]) : nodes[i];
+      }
+      nodes.resize(next);
+    }
+    return nodes.front();
+  }
+
+  /**
+   * Root of a tree of `count` leaves rebuilt from the leaf at `index` and its proof, the
+   * siblings from the bottom level up. Levels where the node moved up unchanged have no sibling.
+   */
+  inline checksum256 root_from_proof(checksum256 hash, uint32_t index, uint32_t count, const std::vector<checksum256>& proof){
+    check( index < count, "leaf index out of range" );
+    size_t used = 0;
+    for( ; count > 1; index /= 2, count = (count + 1) / 2 ){
+      if( index % 2 == 1 ){
+        check( used < proof.size(), "merkle proof too short" );
+        hash = node_hash(proof[used++], hash);
+      }
+      else if( index + 1 < count ){
+        check( used < proof.size(), "merkle proof too short" );
+        hash = node_hash(hash, proof[used++]);
+      }
+    }
+    check( used == proof.size(), "merkle proof too long" );
+    return hash;
+  }
+
+} } /// namespace eosio::merkle
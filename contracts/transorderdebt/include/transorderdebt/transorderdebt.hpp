@@ -1,6 +1,18 @@
 #include <eosio/eosio.hpp>
 #include <eosio/system.hpp>
 #include <eosio/asset.hpp>
+#include <eosio/singleton.hpp>
+#include <eosio/crypto.hpp>
+#include <eosio/binary_extension.hpp>
+
+#include <transorderdebt/hashed.hpp>
+#include <transorderdebt/merkle.hpp>
+
+#include <cstring>
+#include <limits>
+#include <map>
+#include <optional>
+#include <tuple>
 
 using namespace eosio;
 
@@ -9,6 +21,69 @@ namespace eosio{
     public:
       using contract::contract;
 
+      struct trans_entry{
+        checksum256 trans_id;
+        name from;
+        name to;
+        asset quantity;
+        std::string memo;
+        asset fee;
+      };
+
+      struct order_entry{
+        uint128_t order_id;
+        name account;
+        std::string logistics;
+        std::string goods_info;
+        name merchant;
+      };
+
+      struct debt_entry{
+        uint128_t debt_id;
+        name debtor;
+        name creditor;
+        asset quantity;
+        asset fee;
+        std::map<std::string, std::string> profile;
+      };
+
+      // fields left empty keep their current value
+      struct order_patch{
+        std::optional<name> account;
+        std::optional<std::string> logistics;
+        std::optional<std::string> goods_info;
+        std::optional<name> merchant;
+      };
+
+      struct debt_patch{
+        std::optional<name> debtor;
+        std::optional<name> creditor;
+        std::optional<asset> quantity;
+        std::optional<asset> fee;
+        std::map<std::string, std::string> profile_set;   // profile entries added or overwritten
+        std::vector<std::string> profile_erase;           // profile keys removed
+      };
+
+      // an order with its text resolved, as returned by `getorders`
+      struct order_view{
+        uint128_t order_id;
+        name account;
+        std::string logistics;
+        std::string goods_info;
+        name merchant;
+        block_timestamp timestamp;
+      };
+
+      // per record result of the batched upserts
+      static constexpr uint8_t upsert_inserted = 0;
+      static constexpr uint8_t upsert_updated = 1;
+      static constexpr uint8_t upsert_rejected = 2;
+
+      // where schema 2 rows are scoped, see `setshard`
+      static constexpr uint8_t shard_none = 0;
+      static constexpr uint8_t shard_by_account = 1;
+      static constexpr uint8_t shard_by_month = 2;
+
       [[eosio::action]]
       void transupsert(checksum256 trans_id, name from, name to, asset quantity, std::string memo, asset fee);
 
@@ -27,6 +102,92 @@ namespace eosio{
       [[eosio::action]]
       void debterase(uint128_t debt_id);
 
+      /**
+       * Updates only the fields present in `patch`. Nothing is written, and the timestamp is
+       * kept, when the patch leaves the record unchanged.
+       */
+      [[eosio::action]]
+      void orderpatch(uint128_t order_id, order_patch patch);
+
+      [[eosio::action]]
+      void debtpatch(uint128_t debt_id, debt_patch patch);
+
+      /**
+       * Anchors a batch of transfer records without storing them: only the Merkle root of the
+       * records (see merkle.hpp), their count and the time range they cover are kept. When
+       * `root` is supplied it must match the root computed from `records`.
+       */
+      [[eosio::action]]
+      void anchortrans(uint64_t batch_id, std::vector<trans_entry> records, block_timestamp first, block_timestamp last, std::optional<checksum256> root);
+
+      /**
+       * Fails unless `record` is leaf `index` of anchored batch `batch_id`, `proof` holding the
+       * sibling hashes from the leaves up.
+       */
+      [[eosio::action]]
+      void verifytrans(uint64_t batch_id, trans_entry record, uint32_t index, std::vector<checksum256> proof);
+
+      /**
+       * Batched forms of the upserts. Records failing validation are skipped instead of
+       * aborting the batch. Returns the upsert_* result of every record, status[i] for record i.
+       */
+      [[eosio::action]]
+      std::vector<uint8_t> transupsertb(std::vector<trans_entry> records);
+
+      [[eosio::action]]
+      std::vector<uint8_t> orderupsertb(std::vector<order_entry> records);
+
+      [[eosio::action]]
+      std::vector<uint8_t> debtupsertb(std::vector<debt_entry> records);
+
+      /**
+       * Returns the requested orders with their blob references resolved; unknown ids are skipped.
+       */
+      [[eosio::action]]
+      std::vector<order_view> getorders(std::vector<uint128_t> order_ids);
+
+      /**
+       * Switches to the hash keyed tables (schema 2). One way only, rows still in the
+       * legacy tables are found through a fallback lookup until `migrate` has moved them.
+       */
+      [[eosio::action]]
+      void setschema(uint8_t schema);
+
+      /**
+       * Selects the scope of schema 2 rows written from now on: get_self() (shard_none), the
+       * `from`/`account`/`debtor` of the row (shard_by_account) or the month of its timestamp
+       * as yyyymm (shard_by_month). The transshards, ordershards and debtshards tables map the
+       * id of every row stored outside get_self() to its scope, so the mode can change at any time.
+       */
+      [[eosio::action]]
+      void setshard(uint8_t mode);
+
+      /**
+       * Keeps records of `table` (transrecords, orders or debts) for `seconds` after their last
+       * write, 0 keeps them forever.
+       */
+      [[eosio::action]]
+      void setretention(name table, uint32_t seconds);
+
+      /**
+       * Erases up to `max_rows` records of `table` last written before `before`, oldest first.
+       * Without the contract's authority, `before` may not lie inside the retention period.
+       */
+      [[eosio::action]]
+      void prune(name table, block_timestamp before, uint32_t max_rows);
+
+      /**
+       * Moves at most `max` rows from the legacy tables into the schema 2 tables.
+       */
+      [[eosio::action]]
+      void migrate(uint32_t max);
+
+      /**
+       * Adds link entries for up to `max` rows of the legacy `table` (orders or debts), from primary
+       * key `lower_bound` on, that were written before the link tables existed.
+       */
+      [[eosio::action]]
+      void linkrows(name table, uint64_t lower_bound, uint32_t max);
 
 
       using trans_upsert_action = eosio::action_wrapper<"transupsert"_n, &transorderdebt::transupsert>;
@@ -41,6 +202,34 @@ namespace eosio{
 
       using debt_erase_aciton = eosio::action_wrapper<"debterase"_n, &transorderdebt::debterase>;
 
+      using order_patch_action = eosio::action_wrapper<"orderpatch"_n, &transorderdebt::orderpatch>;
+
+      using debt_patch_action = eosio::action_wrapper<"debtpatch"_n, &transorderdebt::debtpatch>;
+
+      using anchor_trans_action = eosio::action_wrapper<"anchortrans"_n, &transorderdebt::anchortrans>;
+
+      using verify_trans_action = eosio::action_wrapper<"verifytrans"_n, &transorderdebt::verifytrans>;
+
+      using trans_upsert_batch_action = eosio::action_wrapper<"transupsertb"_n, &transorderdebt::transupsertb>;
+
+      using order_upsert_batch_action = eosio::action_wrapper<"orderupsertb"_n, &transorderdebt::orderupsertb>;
+
+      using debt_upsert_batch_action = eosio::action_wrapper<"debtupsertb"_n, &transorderdebt::debtupsertb>;
+
+      using get_orders_action = eosio::action_wrapper<"getorders"_n, &transorderdebt::getorders>;
+
+      using set_schema_action = eosio::action_wrapper<"setschema"_n, &transorderdebt::setschema>;
+
+      using set_shard_action = eosio::action_wrapper<"setshard"_n, &transorderdebt::setshard>;
+
+      using set_retention_action = eosio::action_wrapper<"setretention"_n, &transorderdebt::setretention>;
+
+      using prune_action = eosio::action_wrapper<"prune"_n, &transorderdebt::prune>;
+
+      using migrate_action = eosio::action_wrapper<"migrate"_n, &transorderdebt::migrate>;
+
+      using link_rows_action = eosio::action_wrapper<"linkrows"_n, &transorderdebt::linkrows>;
+
     private:
 
       struct [[eosio::table]] transrecord{
@@ -68,6 +257,8 @@ namespace eosio{
         std::string goods_info;
         name merchant;
         block_timestamp timestamp;
+        binary_extension<uint64_t> logistics_ref;   // blob holding logistics, which is then left empty; 0 for none
+        binary_extension<uint64_t> goods_ref;       // blob holding goods_info, which is then left empty; 0 for none
 
         uint64_t primary_key() const{ return pkey; }
         uint128_t get_secondary_1() const { return order_id; }
@@ -76,6 +267,89 @@ namespace eosio{
       using order_index = eosio::multi_index<"orders"_n, order, indexed_by<"byorderid"_n, const_mem_fun<order,
       uint128_t, &order::get_secondary_1>>>;
 
+      /**
+       * Content addressed strings shared by order rows. A blob is placed at the first free slot
+       * from the hash of its data and erased once no row references it. The probe stops at the
+       * first free slot, so data behind a freed slot may be stored twice; references stay valid
+       * since blobs never move. Id 0 is never used, it is what a rewritten legacy row reads back.
+       */
+      struct [[eosio::table]] blob{
+        uint64_t id;
+        std::string data;
+        uint32_t refs;
+
+        uint64_t primary_key() const { return id; }
+      };
+
+      using blob_index = eosio::multi_index<"blobs"_n, blob>;
+
+      // opened on first use and kept for the rest of the action
+      blob_index& blobs(){
+        if( !_blobs ){
+          _blobs.emplace(get_self(), get_self().value);
+        }
+        return *_blobs;
+      }
+
+      uint64_t intern_blob(const std::string& data){
+        auto& blobs = this->blobs();
+        for( uint64_t id = derive_key(sha256(data.data(), data.size())); ; ++id ){
+          if( id == 0 ){
+            continue;
+          }
+          auto iterator = blobs.find(id);
+          if( iterator == blobs.end() ){
+            blobs.emplace(get_self(), [&](auto& row){
+              row.id = id;
+              row.data = data;
+              row.refs = 1;
+            });
+            return id;
+          }
+          if( iterator->data == data ){
+            blobs.modify(iterator, same_payer, [&](auto& row){ ++row.refs; });
+            return id;
+          }
+        }
+      }
+
+      void release_blob(uint64_t id){
+        auto& blobs = this->blobs();
+        const auto& row = blobs.get(id, "unknown blob");
+        if( row.refs > 1 ){
+          blobs.modify(row, same_payer, [&](auto& r){ --r.refs; });
+        }
+        else{
+          blobs.erase(row);
+        }
+      }
+
+      static bool has_blob(const binary_extension<uint64_t>& ref){ return ref && *ref != 0; }
+
+      std::string blob_data(const binary_extension<uint64_t>& ref, const std::string& inline_data){
+        if( !has_blob(ref) ){
+          return inline_data;
+        }
+        return blobs().get(*ref, "unknown blob").data;
+      }
+
+      order make_order(const order_entry& entry, block_timestamp timestamp){
+        order row{ 0, entry.order_id, entry.account, {}, {}, entry.merchant, timestamp };
+        row.logistics_ref.emplace(intern_blob(entry.logistics));
+        row.goods_ref.emplace(intern_blob(entry.goods_info));
+        return row;
+      }
+
+      order_entry order_entry_of(const order& row){
+        return { row.order_id, row.account, blob_data(row.logistics_ref, row.logistics), blob_data(row.goods_ref, row.goods_info), row.merchant };
+      }
+
+      // profile entry whose key is interned in the profilekeys table
+      struct profile_field{
+        unsigned_int key_id;
+        std::string value;
+      };
+
       struct [[eosio::table]] debt{
         uint64_t pkey;
         uint128_t debt_id;
@@ -83,8 +357,9 @@ namespace eosio{
         name creditor;
         asset quantity;
         asset fee;
-        std::map<std::string, std::string> profile;
+        std::map<std::string, std::string> profile;   // left empty once compact_profile is present
         block_timestamp timestamp;
+        binary_extension<std::vector<profile_field>> compact_profile;
 
         uint64_t primary_key() const { return pkey; }
         uint128_t get_secondary_1() const { return debt_id; }
@@ -92,5 +367,697 @@ namespace eosio{
 
       using debt_index = eosio::multi_index<"debts"_n, debt, indexed_by<"bydebtid"_n, const_mem_fun<debt,
       uint128_t, &debt::get_secondary_1>>>;
+
+      struct [[eosio::table]] profile_key{
+        uint64_t id;
+        std::string key;
+
+        uint64_t primary_key() const { return id; }
+        uint64_t get_secondary_1() const { return key_hash(key); }
+      };
+
+      using profile_key_index = eosio::multi_index<"profilekeys"_n, profile_key, indexed_by<"bykeyhash"_n, const_mem_fun<profile_key,
+      uint64_t, &profile_key::get_secondary_1>>>;
+
+      static uint64_t key_hash(const std::string& key){ return derive_key(sha256(key.data(), key.size())); }
+
+      /**
+       * Maps profile keys to their interned ids, adding keys seen for the first time.
+       * Keeps lookups in memory so a batch resolves each distinct key once.
+       */
+      class profile_dictionary{
+        public:
+          explicit profile_dictionary(name self) : _self(self), _keys(self, self.value) {}
+
+          std::vector<profile_field> encode(const std::map<std::string, std::string>& profile);
+
+          std::map<std::string, std::string> decode(const debt& row);
+
+        private:
+          uint64_t intern(const std::string& key);
+
+          name _self;
+          profile_key_index _keys;
+          std::map<std::string, uint64_t> _ids;
+      };
+
+      static debt make_debt(profile_dictionary& dictionary, const debt_entry& entry, block_timestamp timestamp){
+        debt row{ 0, entry.debt_id, entry.debtor, entry.creditor, entry.quantity, entry.fee, {}, timestamp };
+        row.compact_profile.emplace(dictionary.encode(entry.profile));
+        return row;
+      }
+
+      // schema 2: same rows, pkey is derived from the external id (see hashed_find), no secondary index
+      using transrecord2_index = eosio::multi_index<"transrecs2"_n, transrecord>;
+
+      using order2_index = eosio::multi_index<"orders2"_n, order>;
+
+      using debt2_index = eosio::multi_index<"debts2"_n, debt>;
+
+      struct [[eosio::table]] trans_anchor{
+        uint64_t batch_id;
+        checksum256 root;
+        uint32_t count;
+        block_timestamp first;
+        block_timestamp last;
+        block_timestamp anchored;
+
+        uint64_t primary_key() const { return batch_id; }
+      };
+
+      using trans_anchor_index = eosio::multi_index<"transanchors"_n, trans_anchor>;
+
+      struct [[eosio::table("config")]] config{
+        uint8_t schema = 1;
+        bool legacy_rows = false;   // legacy tables may still hold rows not yet migrated
+        binary_extension<uint8_t> shard_mode;
+
+        uint8_t sharding() const { return shard_mode ? *shard_mode : shard_none; }
+      };
+
+      using config_singleton = eosio::singleton<"config"_n, config>;
+
+      config get_config() const { return config_singleton(get_self(), get_self().value).get_or_default(); }
+
+      static uint64_t derive_key(const checksum256& id){
+        const auto bytes = id.extract_as_byte_array();
+        uint64_t key;
+        memcpy(&key, bytes.data(), sizeof(key));
+        return key;
+      }
+
+      // sequential ids must not land in adjacent slots, hashed_erase walks the whole probe run
+      static uint64_t derive_key(uint128_t id){
+        return mix_bits(static_cast<uint64_t>(id) ^ mix_bits(static_cast<uint64_t>(id >> 64)));
+      }
+
+      // splitmix64 finalizer
+      static constexpr uint64_t mix_bits(uint64_t x){
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+      }
+
+      struct [[eosio::table]] trans_shard{
+        uint64_t pkey;
+        checksum256 trans_id;
+        uint64_t scope;
+
+        uint64_t primary_key() const { return pkey; }
+      };
+
+      struct [[eosio::table]] id_shard{
+        uint64_t pkey;
+        uint128_t id;
+        uint64_t scope;
+
+        uint64_t primary_key() const { return pkey; }
+      };
+
+      // keyed like the schema 2 tables, only rows scoped outside get_self() have an entry
+      using trans_shard_index = eosio::multi_index<"transshards"_n, trans_shard>;
+
+      using order_shard_index = eosio::multi_index<"ordershards"_n, id_shard>;
+
+      using debt_shard_index = eosio::multi_index<"debtshards"_n, id_shard>;
+
+      /**
+       * Secondary lookups for orders and debts: one row per record, keyed like the schema 2 tables,
+       * holding the scope of the record (0 while it is still in the legacy table) and
+       * (account, timestamp) composite keys.
+       */
+      struct [[eosio::table]] order_link{
+        uint64_t pkey;
+        uint128_t order_id;
+        uint64_t scope;
+        uint128_t merchant_key;
+        uint128_t account_key;
+
+        uint64_t primary_key() const { return pkey; }
+        uint128_t get_secondary_1() const { return merchant_key; }
+        uint128_t get_secondary_2() const { return account_key; }
+      };
+
+      using order_link_index = eosio::multi_index<"orderlinks"_n, order_link,
+      indexed_by<"bymerchant"_n, const_mem_fun<order_link, uint128_t, &order_link::get_secondary_1>>,
+      indexed_by<"byaccount"_n, const_mem_fun<order_link, uint128_t, &order_link::get_secondary_2>>>;
+
+      struct [[eosio::table]] debt_link{
+        uint64_t pkey;
+        uint128_t debt_id;
+        uint64_t scope;
+        uint128_t debtor_key;
+        uint128_t creditor_key;
+
+        uint64_t primary_key() const { return pkey; }
+        uint128_t get_secondary_1() const { return debtor_key; }
+        uint128_t get_secondary_2() const { return creditor_key; }
+      };
+
+      using debt_link_index = eosio::multi_index<"debtlinks"_n, debt_link,
+      indexed_by<"bydebtor"_n, const_mem_fun<debt_link, uint128_t, &debt_link::get_secondary_1>>,
+      indexed_by<"bycreditor"_n, const_mem_fun<debt_link, uint128_t, &debt_link::get_secondary_2>>>;
+
+      static bool same_entry(const order_link& a, const order_link& b){
+        return a.scope == b.scope && a.merchant_key == b.merchant_key && a.account_key == b.account_key;
+      }
+
+      static bool same_entry(const debt_link& a, const debt_link& b){
+        return a.scope == b.scope && a.debtor_key == b.debtor_key && a.creditor_key == b.creditor_key;
+      }
+
+      static uint128_t composite_key(name account, block_timestamp timestamp){
+        return (static_cast<uint128_t>(account.value) << 64) | timestamp.slot;
+      }
+
+      // last write time of every record, whatever table or scope it is stored in
+      struct [[eosio::table]] trans_age{
+        uint64_t pkey;
+        checksum256 trans_id;
+        block_timestamp timestamp;
+
+        uint64_t primary_key() const { return pkey; }
+        uint64_t get_secondary_1() const { return timestamp.slot; }
+      };
+
+      struct [[eosio::table]] id_age{
+        uint64_t pkey;
+        uint128_t id;
+        block_timestamp timestamp;
+
+        uint64_t primary_key() const { return pkey; }
+        uint64_t get_secondary_1() const { return timestamp.slot; }
+      };
+
+      template<typename Age>
+      static bool same_entry(const Age& a, const Age& b){ return a.timestamp.slot == b.timestamp.slot; }
+
+      using trans_age_index = eosio::multi_index<"transages"_n, trans_age, indexed_by<"bytime"_n, const_mem_fun<trans_age,
+      uint64_t, &trans_age::get_secondary_1>>>;
+
+      using order_age_index = eosio::multi_index<"orderages"_n, id_age, indexed_by<"bytime"_n, const_mem_fun<id_age,
+      uint64_t, &id_age::get_secondary_1>>>;
+
+      using debt_age_index = eosio::multi_index<"debtages"_n, id_age, indexed_by<"bytime"_n, const_mem_fun<id_age,
+      uint64_t, &id_age::get_secondary_1>>>;
+
+      struct [[eosio::table("retention")]] retention{
+        uint32_t trans_sec = 0;   // 0 keeps records forever
+        uint32_t order_sec = 0;
+        uint32_t debt_sec = 0;
+      };
+
+      using retention_singleton = eosio::singleton<"retention"_n, retention>;
+
+      static uint32_t& retention_period(retention& policy, name table){
+        if( table == "orders"_n ){
+          return policy.order_sec;
+        }
+        if( table == "debts"_n ){
+          return policy.debt_sec;
+        }
+        check( table == "transrecords"_n, "unknown table" );
+        return policy.trans_sec;
+      }
+
+      static const checksum256& external_id(const transrecord& row){ return row.trans_id; }
+      static uint128_t external_id(const order& row){ return row.order_id; }
+      static uint128_t external_id(const debt& row){ return row.debt_id; }
+      static const checksum256& external_id(const trans_shard& row){ return row.trans_id; }
+      static uint128_t external_id(const id_shard& row){ return row.id; }
+      static uint128_t external_id(const order_link& row){ return row.order_id; }
+      static uint128_t external_id(const debt_link& row){ return row.debt_id; }
+      static const checksum256& external_id(const trans_age& row){ return row.trans_id; }
+      static uint128_t external_id(const id_age& row){ return row.id; }
+
+      // transfers have no link table
+      struct no_links{
+        no_links(name, uint64_t){}
+      };
+
+      template<typename Kind>
+      struct kind_tables;
+
+      // tables holding one kind of record, used by the generic helpers below; upgrade brings a row
+      // read from storage to the current row format before it is written again
+      struct trans_tables{
+        using legacy = transrecord_index;
+        using table = transrecord2_index;
+        using shards = trans_shard_index;
+        using ages = trans_age_index;
+        using links = no_links;
+        static std::optional<kind_tables<trans_tables>>& cached(transorderdebt& self){ return self._trans_tables; }
+        static constexpr eosio::name::raw legacy_index = "bytransid"_n;
+        static name account(const transrecord& row){ return row.from; }
+        static void link(transorderdebt&, const transrecord&, uint64_t){}
+        static void unlink(transorderdebt&, const checksum256&){}
+        static void release(transorderdebt&, const transrecord&){}
+        static transrecord upgrade(transorderdebt&, const transrecord& row){ return row; }
+      };
+
+      struct order_tables{
+        using legacy = order_index;
+        using table = order2_index;
+        using shards = order_shard_index;
+        using ages = order_age_index;
+        using links = order_link_index;
+        static std::optional<kind_tables<order_tables>>& cached(transorderdebt& self){ return self._order_tables; }
+        static constexpr eosio::name::raw legacy_index = "byorderid"_n;
+        static name account(const order& row){ return row.account; }
+        static void link(transorderdebt& self, const order& row, uint64_t scope){
+          self.store_link(self.tables_of<order_tables>().links, row.order_id, scope, composite_key(row.merchant, row.timestamp), composite_key(row.account, row.timestamp));
+        }
+        static void unlink(transorderdebt& self, uint128_t id){ self.erase_entry(self.tables_of<order_tables>().links, id); }
+        static void release(transorderdebt& self, const order& row){
+          if( has_blob(row.logistics_ref) ){
+            self.release_blob(*row.logistics_ref);
+          }
+          if( has_blob(row.goods_ref) ){
+            self.release_blob(*row.goods_ref);
+          }
+        }
+        // a row written before the blobs table carries its text inline
+        static order upgrade(transorderdebt& self, const order& row){
+          if( has_blob(row.logistics_ref) || has_blob(row.goods_ref) ){
+            return row;
+          }
+          order updated = self.make_order(self.order_entry_of(row), row.timestamp);
+          updated.pkey = row.pkey;
+          return updated;
+        }
+      };
+
+      struct debt_tables{
+        using legacy = debt_index;
+        using table = debt2_index;
+        using shards = debt_shard_index;
+        using ages = debt_age_index;
+        using links = debt_link_index;
+        static std::optional<kind_tables<debt_tables>>& cached(transorderdebt& self){ return self._debt_tables; }
+        static constexpr eosio::name::raw legacy_index = "bydebtid"_n;
+        static name account(const debt& row){ return row.debtor; }
+        static void link(transorderdebt& self, const debt& row, uint64_t scope){
+          self.store_link(self.tables_of<debt_tables>().links, row.debt_id, scope, composite_key(row.debtor, row.timestamp), composite_key(row.creditor, row.timestamp));
+        }
+        static void unlink(transorderdebt& self, uint128_t id){ self.erase_entry(self.tables_of<debt_tables>().links, id); }
+        static void release(transorderdebt&, const debt&){}
+        // a row written before profile keys were interned keeps its profile only in `profile`
+        static debt upgrade(transorderdebt& self, const debt& row){
+          if( row.compact_profile && row.profile.empty() ){
+            return row;
+          }
+          profile_dictionary dictionary(self.get_self());
+          debt updated = row;
+          updated.compact_profile.emplace(dictionary.encode(dictionary.decode(row)));
+          updated.profile.clear();
+          return updated;
+        }
+      };
+
+      /**
+       * Handles on the tables of one kind of record. They are opened once per action and shared by
+       * the helpers below, so a batch does not reopen them for every record and each helper reads
+       * the rows the others wrote through the same multi_index cache. Scopes of the schema 2 table
+       * are opened on first use.
+       */
+      template<typename Kind>
+      struct kind_tables{
+        explicit kind_tables(name self)
+        : self(self), legacy(self, self.value), shards(self, self.value), ages(self, self.value), links(self, self.value) {}
+
+        typename Kind::table& scoped(uint64_t scope){
+          auto iterator = tables.find(scope);
+          if( iterator == tables.end() ){
+            iterator = tables.emplace(std::piecewise_construct, std::forward_as_tuple(scope), std::forward_as_tuple(self, scope)).first;
+          }
+          return iterator->second;
+        }
+
+        name self;
+        typename Kind::legacy legacy;
+        typename Kind::shards shards;
+        typename Kind::ages ages;
+        typename Kind::links links;
+        std::map<uint64_t, typename Kind::table> tables;
+      };
+
+      std::optional<kind_tables<trans_tables>> _trans_tables;
+      std::optional<kind_tables<order_tables>> _order_tables;
+      std::optional<kind_tables<debt_tables>> _debt_tables;
+      std::optional<blob_index> _blobs;
+
+      template<typename Kind>
+      kind_tables<Kind>& tables_of(){
+        auto& cached = Kind::cached(*this);
+        if( !cached ){
+          cached.emplace(get_self());
+        }
+        return *cached;
+      }
+
+      // civil month of the timestamp as yyyymm
+      static uint64_t month_bucket(block_timestamp timestamp){
+        const uint32_t days = timestamp.to_time_point().sec_since_epoch() / 86400 + 719468;
+        const uint32_t era = days / 146097;
+        const uint32_t doe = days - era * 146097;
+        const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        const uint32_t mp = (5 * doy + 2) / 153;
+        const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+        const uint64_t year = era * 400 + yoe + (month <= 2);
+        return year * 100 + month;
+      }
+
+      uint64_t shard_scope(const config& cfg, name account, block_timestamp timestamp) const {
+        switch( cfg.sharding() ){
+          case shard_by_account: return account.value;
+          case shard_by_month: return month_bucket(timestamp);
+          default: return get_self().value;
+        }
+      }
+
+      /**
+       * Open addressing over the primary key, see hashed.hpp: the home slot of a row is
+       * derive_key(id). Returns the row if present, and the slot it occupies or would occupy.
+       */
+      template<typename Table, typename Id>
+      static std::pair<typename Table::const_iterator, uint64_t> hashed_find(const Table& table, const Id& id){
+        return hashed::find(table, derive_key(id), [&](const auto& row){ return external_id(row) == id; });
+      }
+
+      template<typename Table, typename Row>
+      void hashed_insert(Table& table, uint64_t slot, const Row& row){
+        hashed::insert(table, get_self(), slot, row);
+      }
+
+      template<typename Table>
+      void hashed_erase(Table& table, typename Table::const_iterator iterator){
+        hashed::erase(table, get_self(), iterator, [](const auto& row){ return derive_key(external_id(row)); });
+      }
+
+      /**
+       * Inserts or overwrites the row with the same external id, returns true when inserted.
+       * A stored row equal to `row` (see same_entry) is left untouched.
+       */
+      template<typename Table, typename Row>
+      bool hashed_upsert(Table& table, const Row& row){
+        auto slot = hashed_find(table, external_id(row));
+        if( slot.first == table.end() ){
+          hashed_insert(table, slot.second, row);
+          return true;
+        }
+        if( same_entry(*slot.first, row) ){
+          return false;
+        }
+        table.modify(slot.first, get_self(), [&](auto& r){
+          r = row;
+          r.pkey = slot.second;
+        });
+        return false;
+      }
+
+      /**
+       * Schema 2 fallback for rows not migrated yet: erases the row with `id` from the legacy table.
+       */
+      template<typename Kind, typename Id>
+      bool erase_legacy(const Id& id){
+        auto index = tables_of<Kind>().legacy.template get_index<Kind::legacy_index>();
+        auto iterator = index.find(id);
+        if( iterator == index.end() ){
+          return false;
+        }
+        Kind::release(*this, *iterator);
+        index.erase(iterator);
+        return true;
+      }
+
+      template<typename Kind, typename Id>
+      uint64_t shard_of(const Id& id){
+        const auto& shards = tables_of<Kind>().shards;
+        auto slot = hashed_find(shards, id);
+        return slot.first == shards.end() ? get_self().value : slot.first->scope;
+      }
+
+      /**
+       * Points the shard entry of `id` at `scope` and erases the row from the shard it was
+       * in before. Returns true when a row was erased.
+       */
+      template<typename Kind, typename Id>
+      bool move_shard(const Id& id, uint64_t scope){
+        auto& tables = tables_of<Kind>();
+        auto& shards = tables.shards;
+        auto slot = hashed_find(shards, id);
+        const uint64_t current = slot.first == shards.end() ? get_self().value : slot.first->scope;
+        if( current == scope ){
+          return false;
+        }
+
+        if( scope == get_self().value ){
+          hashed_erase(shards, slot.first);
+        }
+        else if( slot.first == shards.end() ){
+          hashed_insert(shards, slot.second, typename Kind::shards::value_type{ 0, id, scope });
+        }
+        else{
+          shards.modify(slot.first, get_self(), [&](auto& r){ r.scope = scope; });
+        }
+
+        auto& previous = tables.scoped(current);
+        auto row = hashed_find(previous, id);
+        if( row.first == previous.end() ){
+          return false;
+        }
+        Kind::release(*this, *row.first);
+        hashed_erase(previous, row.first);
+        return true;
+      }
+
+      /**
+       * Schema 2 upsert into the shard selected for the row, returns true when the row
+       * already existed in some shard.
+       */
+      template<typename Kind, typename Row>
+      bool store_row(const config& cfg, const Row& row){
+        const uint64_t scope = shard_scope(cfg, Kind::account(row), row.timestamp);
+        const bool moved = move_shard<Kind>(external_id(row), scope);
+        auto& table = tables_of<Kind>().scoped(scope);
+        auto slot = hashed_find(table, external_id(row));
+        if( slot.first == table.end() ){
+          hashed_insert(table, slot.second, row);
+        }
+        else{
+          Kind::release(*this, *slot.first);
+          table.modify(slot.first, get_self(), [&](auto& r){
+            r = row;
+            r.pkey = slot.second;
+          });
+        }
+        track_row<Kind>(row, scope);
+        const bool existed = moved || slot.first != table.end();
+        return existed;
+      }
+
+      template<typename Links, typename Id>
+      void store_link(Links& links, const Id& id, uint64_t scope, uint128_t first_key, uint128_t second_key){
+        hashed_upsert(links, typename Links::value_type{ 0, id, scope, first_key, second_key });
+      }
+
+      template<typename Table, typename Id>
+      void erase_entry(Table& table, const Id& id){
+        auto slot = hashed_find(table, id);
+        if( slot.first != table.end() ){
+          hashed_erase(table, slot.first);
+        }
+      }
+
+      // keeps the link and age entries of a record current, scope 0 stands for the legacy table
+      template<typename Kind, typename Row>
+      void track_row(const Row& row, uint64_t scope){
+        Kind::link(*this, row, scope);
+        hashed_upsert(tables_of<Kind>().ages, typename Kind::ages::value_type{ 0, external_id(row), row.timestamp });
+      }
+
+      template<typename Kind>
+      void link_legacy(uint64_t lower_bound, uint32_t max){
+        auto& tables = tables_of<Kind>();
+        const auto& legacy = tables.legacy;
+        const auto& links = tables.links;
+        uint32_t visited = 0;
+        for( auto iterator = legacy.lower_bound(lower_bound); iterator != legacy.end() && visited < max; ++iterator, ++visited ){
+          // an existing entry is at least as recent, it may point at a schema 2 row
+          if( hashed_find(links, external_id(*iterator)).first == links.end() ){
+            Kind::link(*this, *iterator, 0);
+          }
+        }
+      }
+
+      template<typename Kind, typename Id>
+      void untrack_row(const Id& id){
+        Kind::unlink(*this, id);
+        erase_entry(tables_of<Kind>().ages, id);
+      }
+
+      /**
+       * Erases up to `max_rows` records last written before `before`, oldest first. Legacy rows
+       * written since age tracking exists have an age entry and are pruned through it. Untracked
+       * legacy rows are taken from the front of their table, in primary key order, which is not
+       * strictly time order: the scan stops at the first untracked row not due yet, so older rows
+       * behind it are pruned by a call with a later `before`.
+       */
+      template<typename Kind>
+      uint32_t prune_rows(const config& cfg, block_timestamp before, uint32_t max_rows){
+        auto& tables = tables_of<Kind>();
+        uint32_t pruned = 0;
+        uint32_t visited = 0;
+        for( auto iterator = tables.legacy.begin(); iterator != tables.legacy.end() && visited < max_rows && pruned < max_rows; ++visited ){
+          const auto id = external_id(*iterator);
+          if( hashed_find(tables.ages, id).first != tables.ages.end() ){
+            ++iterator;
+            continue;
+          }
+          if( !(iterator->timestamp < before) ){
+            break;
+          }
+          Kind::unlink(*this, id);
+          Kind::release(*this, *iterator);
+          iterator = tables.legacy.erase(iterator);
+          ++pruned;
+        }
+
+        // erase_row and untrack_row shift age entries through the same handle, begin() sees them
+        auto index = tables.ages.template get_index<"bytime"_n>();
+        for( ; pruned < max_rows; ++pruned ){
+          auto iterator = index.begin();
+          if( iterator == index.end() || !(iterator->timestamp < before) ){
+            break;
+          }
+          const auto id = external_id(*iterator);
+          erase_row<Kind>(cfg, id);
+          // drops the entry even if the record itself was already gone
+          untrack_row<Kind>(id);
+        }
+        return pruned;
+      }
+
+      template<typename Kind, typename Row>
+      uint8_t upsert_row(const config& cfg, const Row& row){
+        if( cfg.schema >= 2 ){
+          if( store_row<Kind>(cfg, row) ){
+            return upsert_updated;
+          }
+          const bool replaced = cfg.legacy_rows && erase_legacy<Kind>(external_id(row));
+          return replaced ? upsert_updated : upsert_inserted;
+        }
+
+        auto& legacy = tables_of<Kind>().legacy;
+        auto index = legacy.template get_index<Kind::legacy_index>();
+        auto iterator = index.find(external_id(row));
+        track_row<Kind>(row, 0);
+        if( iterator == index.end() ){
+          hashed_insert(legacy, legacy.available_primary_key(), row);
+          return upsert_inserted;
+        }
+        Kind::release(*this, *iterator);
+        index.modify(iterator, get_self(), [&](auto& r){
+          const auto pkey = r.pkey;
+          r = row;
+          r.pkey = pkey;
+        });
+        return upsert_updated;
+      }
+
+      template<typename Kind, typename Id>
+      std::optional<typename Kind::table::value_type> find_row(const config& cfg, const Id& id){
+        if( cfg.schema >= 2 ){
+          const auto& table = tables_of<Kind>().scoped(shard_of<Kind>(id));
+          auto slot = hashed_find(table, id);
+          if( slot.first != table.end() ){
+            return *slot.first;
+          }
+          if( !cfg.legacy_rows ){
+            return {};
+          }
+        }
+        auto index = tables_of<Kind>().legacy.template get_index<Kind::legacy_index>();
+        auto iterator = index.find(id);
+        if( iterator == index.end() ){
+          return {};
+        }
+        return *iterator;
+      }
+
+      template<typename T>
+      static bool patch_field(T& field, const std::optional<T>& value){
+        if( !value || *value == field ){
+          return false;
+        }
+        field = *value;
+        return true;
+      }
+
+      template<typename Kind, typename Id>
+      bool erase_row(const config& cfg, const Id& id){
+        if( cfg.schema >= 2 ){
+          auto& tables = tables_of<Kind>();
+          auto& shards = tables.shards;
+          auto shard = hashed_find(shards, id);
+          auto& table = tables.scoped(shard.first == shards.end() ? get_self().value : shard.first->scope);
+          auto slot = hashed_find(table, id);
+          if( slot.first != table.end() ){
+            Kind::release(*this, *slot.first);
+            hashed_erase(table, slot.first);
+            if( shard.first != shards.end() ){
+              hashed_erase(shards, shard.first);
+            }
+            untrack_row<Kind>(id);
+            return true;
+          }
+          if( !cfg.legacy_rows ){
+            return false;
+          }
+        }
+        if( !erase_legacy<Kind>(id) ){
+          return false;
+        }
+        untrack_row<Kind>(id);
+        return true;
+      }
+
+      // is_account results memoized over one batch
+      using account_cache = std::map<name, bool>;
+
+      static bool account_exists(account_cache& accounts, name account){
+        auto iterator = accounts.find(account);
+        if( iterator == accounts.end() ){
+          iterator = accounts.emplace(account, is_account(account)).first;
+        }
+        return iterator->second;
+      }
+
+      static bool valid_transfer(account_cache& accounts, name from, name to, const asset& quantity, const asset& fee){
+        return from != to && account_exists(accounts, from) && account_exists(accounts, to)
+            && quantity.is_valid() && fee.is_valid() && quantity.amount > 0 && fee.amount >= 0
+            && quantity.symbol == fee.symbol;
+      }
+
+      template<typename Kind>
+      uint32_t migrate_rows(const config& cfg, uint32_t max){
+        auto& tables = tables_of<Kind>();
+        auto& legacy = tables.legacy;
+        uint32_t moved = 0;
+        for( auto iterator = legacy.begin(); iterator != legacy.end() && moved < max; ++moved ){
+          const auto& id = external_id(*iterator);
+          const auto& table = tables.scoped(shard_of<Kind>(id));
+          // a row already written through schema 2 is newer than the legacy one
+          if( hashed_find(table, id).first == table.end() ){
+            store_row<Kind>(cfg, Kind::upgrade(*this, *iterator));
+          }
+          else{
+            Kind::release(*this, *iterator);
+          }
+          iterator = legacy.erase(iterator);
+        }
+        return moved;
+      }
   };
-};
\ No newline at end of file
+};
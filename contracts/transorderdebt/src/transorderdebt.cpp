@@ -15,50 +15,15 @@ namespace eosio{
     check( quantity.symbol == fee.symbol, "symbol precision mismatch" );
     check( memo.size() <= 256, "memo has more than 256 bytes" );
 
-    transrecord_index transrecords(get_self(), get_self().value);
-
-    auto trans_id_index = transrecords.get_index<name("bytransid")>();
-
-    auto iterator = trans_id_index.find(trans_id);
-
-    if( iterator == trans_id_index.end()){
-      transrecords.emplace(get_self(), [&]( auto& row){
-        row.pkey = transrecords.available_primary_key();
-        row.trans_id = trans_id;
-        row.from = from;
-        row.to = to;
-        row.quantity = quantity;
-        row.memo = memo;
-        row.fee = fee;
-        row.timestamp = current_block_time();
-      });
-    }
-    else{
-      transrecords.modify(*iterator, get_self(), [&](auto& row){
-        row.trans_id = trans_id;
-        row.from = from;
-        row.to = to;
-        row.quantity = quantity;
-        row.memo = memo;
-        row.fee = fee;
-        row.timestamp = current_block_time();
-      });
-    }
+    const transrecord row{ 0, trans_id, from, to, quantity, memo, fee, current_block_time() };
+    upsert_row<trans_tables>(get_config(), row);
   }
 
 
   void transorderdebt::transerase(checksum256 trans_id){
     require_auth(get_self());
 
-    transrecord_index transrecords(get_self(), get_self().value);
-
-    auto trans_id_index = transrecords.get_index<name("bytransid")>();
-
-    auto iterator = trans_id_index.find(trans_id);
-
-    check(iterator != trans_id_index.end(), "Transrecord does not exist");
-
-    trans_id_index.erase(iterator);
+    check( erase_row<trans_tables>(get_config(), trans_id), "Transrecord does not exist" );
   }
 
 
@@ -66,49 +31,15 @@ namespace eosio{
 
  		require_auth( get_self() );
 
- 		order_index orders(get_self(), get_self().value);
-
- 		auto order_id_index = orders.get_index<name("byorderid")>();
-
- 		auto iterator = order_id_index.find(order_id);
-
- 		if( iterator == order_id_index.end() )
-	    {
-	    	orders.emplace(get_self(), [&]( auto& row ) {
-	    		row.pkey = orders.available_primary_key();
-	    		row.order_id = order_id;
-        	row.account = account;
-        	row.logistics = logistics;
-        	row.goods_info = goods_info;
-        	row.merchant = merchant;
-        	row.timestamp = current_block_time();
-	      });
-	    }
-	    else {
-	      orders.modify(*iterator, get_self(), [&]( auto& row ) {
-	        row.order_id = order_id;
-	        row.account = account;
-	        row.logistics = logistics;
-	        row.goods_info = goods_info;
-	        row.merchant = merchant;
-	        row.timestamp = current_block_time();
-	      });
-	    }
+    const order_entry entry{ order_id, account, std::move(logistics), std::move(goods_info), merchant };
+    upsert_row<order_tables>(get_config(), make_order(entry, current_block_time()));
  	}
 
  	void transorderdebt::ordererase(uint128_t order_id){
 
  		require_auth( get_self() );
 
- 		order_index orders(get_self(), get_self().value);
-
- 		auto order_id_index = orders.get_index<name("byorderid")>();
-
- 		auto iterator = order_id_index.find(order_id);
-
- 		check(iterator != order_id_index.end(), "Order does not exist");
-
- 		order_id_index.erase(iterator);
+    check( erase_row<order_tables>(get_config(), order_id), "Order does not exist" );
  	}
 
 
@@ -125,51 +56,350 @@ namespace eosio{
     check( fee.amount >= 0, "must transfer positive quantity" );
     check( quantity.symbol == fee.symbol, "symbol precision mismatch" );
 
-    debt_index debts(get_self(), get_self().value);
+    profile_dictionary dictionary(get_self());
+    const debt_entry entry{ debt_id, debtor, creditor, quantity, fee, std::move(profile) };
+    upsert_row<debt_tables>(get_config(), make_debt(dictionary, entry, current_block_time()));
+  }
 
-    auto debt_id_index = debts.get_index<name("bydebtid")>();
 
-    auto iterator = debt_id_index.find(debt_id);
+  void transorderdebt::debterase(uint128_t debt_id){
+    require_auth(get_self());
 
-    if( iterator == debt_id_index.end()){
-      debts.emplace(get_self(), [&]( auto& row){
-        row.pkey = debts.available_primary_key();
-        row.debt_id = debt_id;
-        row.debtor = debtor;
-        row.creditor = creditor;
-        row.quantity = quantity;
-        row.fee = fee;
-        row.profile.clear();
-        row.profile = profile;
-        row.timestamp = current_block_time();
-      });
+    check( erase_row<debt_tables>(get_config(), debt_id), "Debt does not exist" );
+  }
+
+
+  void transorderdebt::orderpatch(uint128_t order_id, order_patch patch){
+    require_auth(get_self());
+
+    const auto cfg = get_config();
+    auto row = find_row<order_tables>(cfg, order_id);
+    check( row.has_value(), "Order does not exist" );
+
+    auto entry = order_entry_of(*row);
+    bool changed = patch_field(entry.account, patch.account);
+    changed |= patch_field(entry.logistics, patch.logistics);
+    changed |= patch_field(entry.goods_info, patch.goods_info);
+    changed |= patch_field(entry.merchant, patch.merchant);
+    if( !changed ){
+      return;
+    }
+
+    upsert_row<order_tables>(cfg, make_order(entry, current_block_time()));
+  }
+
+
+  void transorderdebt::debtpatch(uint128_t debt_id, debt_patch patch){
+    require_auth(get_self());
+
+    const auto cfg = get_config();
+    auto row = find_row<debt_tables>(cfg, debt_id);
+    check( row.has_value(), "Debt does not exist" );
+
+    bool changed = false;
+    if( patch_field(row->debtor, patch.debtor) ){
+      check( is_account( row->debtor ), "debtor account does not exist");
+      changed = true;
+    }
+    if( patch_field(row->creditor, patch.creditor) ){
+      check( is_account( row->creditor ), "creditor account does not exist");
+      changed = true;
+    }
+    changed |= patch_field(row->quantity, patch.quantity);
+    changed |= patch_field(row->fee, patch.fee);
+    if( changed ){
+      check( row->debtor != row->creditor, "debtor and creditor cannot be same one" );
+      check( row->quantity.is_valid(), "invalid quantity" );
+      check( row->fee.is_valid(), "invalid quantity" );
+      check( row->quantity.amount > 0, "must transfer positive quantity" );
+      check( row->fee.amount >= 0, "must transfer positive quantity" );
+      check( row->quantity.symbol == row->fee.symbol, "symbol precision mismatch" );
+    }
+
+    if( !patch.profile_set.empty() || !patch.profile_erase.empty() ){
+      profile_dictionary dictionary(get_self());
+      const auto profile = dictionary.decode(*row);
+      auto updated = profile;
+      for( auto& item : patch.profile_set ){
+        updated[item.first] = std::move(item.second);
+      }
+      for( const auto& key : patch.profile_erase ){
+        updated.erase(key);
+      }
+      if( updated != profile ){
+        row->profile.clear();
+        row->compact_profile.emplace(dictionary.encode(updated));
+        changed = true;
+      }
+    }
+    if( !changed ){
+      return;
+    }
+
+    row->timestamp = current_block_time();
+    upsert_row<debt_tables>(cfg, debt_tables::upgrade(*this, *row));
+  }
+
+
+  void transorderdebt::anchortrans(uint64_t batch_id, std::vector<trans_entry> records, block_timestamp first, block_timestamp last, std::optional<checksum256> root){
+    require_auth(get_self());
+
+    check( !records.empty(), "batch has no records" );
+    check( first <= last, "first is later than last" );
+
+    trans_anchor_index anchors(get_self(), get_self().value);
+    check( anchors.find(batch_id) == anchors.end(), "batch already anchored" );
+
+    std::vector<checksum256> leaves;
+    leaves.reserve(records.size());
+    for( const auto& r : records ){
+      leaves.push_back(merkle::leaf_hash(r));
+    }
+    const checksum256 computed = merkle::root(std::move(leaves));
+    check( !root || *root == computed, "merkle root mismatch" );
+
+    anchors.emplace(get_self(), [&](auto& row){
+      row.batch_id = batch_id;
+      row.root = computed;
+      row.count = records.size();
+      row.first = first;
+      row.last = last;
+      row.anchored = current_block_time();
+    });
+  }
+
+
+  void transorderdebt::verifytrans(uint64_t batch_id, trans_entry record, uint32_t index, std::vector<checksum256> proof){
+    trans_anchor_index anchors(get_self(), get_self().value);
+    const auto& anchor = anchors.get(batch_id, "batch is not anchored");
+
+    check( merkle::root_from_proof(merkle::leaf_hash(record), index, anchor.count, proof) == anchor.root, "record is not part of the batch" );
+  }
+
+
+  std::vector<uint8_t> transorderdebt::transupsertb(std::vector<trans_entry> records){
+    require_auth(get_self());
+
+    const auto cfg = get_config();
+    const block_timestamp now = current_block_time();
+    account_cache accounts;
+
+    std::vector<uint8_t> status;
+    status.reserve(records.size());
+    for( const auto& r : records ){
+      if( !valid_transfer(accounts, r.from, r.to, r.quantity, r.fee) || r.memo.size() > 256 ){
+        status.push_back(upsert_rejected);
+        continue;
+      }
+      const transrecord row{ 0, r.trans_id, r.from, r.to, r.quantity, r.memo, r.fee, now };
+      status.push_back(upsert_row<trans_tables>(cfg, row));
+    }
+
+    return status;
+  }
+
+
+  std::vector<uint8_t> transorderdebt::orderupsertb(std::vector<order_entry> records){
+    require_auth(get_self());
+
+    const auto cfg = get_config();
+    const block_timestamp now = current_block_time();
+
+    std::vector<uint8_t> status;
+    status.reserve(records.size());
+    for( const auto& r : records ){
+      status.push_back(upsert_row<order_tables>(cfg, make_order(r, now)));
+    }
+
+    return status;
+  }
+
+
+  std::vector<uint8_t> transorderdebt::debtupsertb(std::vector<debt_entry> records){
+    require_auth(get_self());
+
+    const auto cfg = get_config();
+    const block_timestamp now = current_block_time();
+    profile_dictionary dictionary(get_self());
+    account_cache accounts;
+
+    std::vector<uint8_t> status;
+    status.reserve(records.size());
+    for( const auto& r : records ){
+      if( !valid_transfer(accounts, r.debtor, r.creditor, r.quantity, r.fee) ){
+        status.push_back(upsert_rejected);
+        continue;
+      }
+      status.push_back(upsert_row<debt_tables>(cfg, make_debt(dictionary, r, now)));
+    }
+
+    return status;
+  }
+
+
+  std::vector<transorderdebt::order_view> transorderdebt::getorders(std::vector<uint128_t> order_ids){
+    const auto cfg = get_config();
+
+    std::vector<order_view> orders;
+    orders.reserve(order_ids.size());
+    for( const auto& order_id : order_ids ){
+      const auto row = find_row<order_tables>(cfg, order_id);
+      if( !row ){
+        continue;
+      }
+      const auto entry = order_entry_of(*row);
+      orders.push_back({ entry.order_id, entry.account, entry.logistics, entry.goods_info, entry.merchant, row->timestamp });
+    }
+    return orders;
+  }
+
+
+  std::vector<transorderdebt::profile_field> transorderdebt::profile_dictionary::encode(const std::map<std::string, std::string>& profile){
+    std::vector<profile_field> fields;
+    fields.reserve(profile.size());
+    for( const auto& item : profile ){
+      fields.push_back({ unsigned_int(static_cast<uint32_t>(intern(item.first))), item.second });
+    }
+    return fields;
+  }
+
+
+  std::map<std::string, std::string> transorderdebt::profile_dictionary::decode(const debt& row){
+    // a legacy row rewritten without conversion reads back with an empty compact_profile
+    if( !row.compact_profile || !row.profile.empty() ){
+      return row.profile;
+    }
+    std::map<std::string, std::string> profile;
+    for( const auto& field : *row.compact_profile ){
+      profile.emplace(_keys.get(field.key_id.value, "unknown profile key").key, field.value);
+    }
+    return profile;
+  }
+
+
+  uint64_t transorderdebt::profile_dictionary::intern(const std::string& key){
+    auto cached = _ids.find(key);
+    if( cached != _ids.end() ){
+      return cached->second;
+    }
+
+    auto key_hash_index = _keys.get_index<"bykeyhash"_n>();
+    const uint64_t hash = key_hash(key);
+    for( auto iterator = key_hash_index.lower_bound(hash); iterator != key_hash_index.end() && iterator->get_secondary_1() == hash; ++iterator ){
+      if( iterator->key == key ){
+        _ids.emplace(key, iterator->id);
+        return iterator->id;
+      }
+    }
+
+    check( key.size() <= 256, "profile key has more than 256 bytes" );
+    const uint64_t id = _keys.available_primary_key();
+    check( id <= std::numeric_limits<uint32_t>::max(), "profile key dictionary is full" );
+    _keys.emplace(_self, [&](auto& row){
+      row.id = id;
+      row.key = key;
+    });
+    _ids.emplace(key, id);
+    return id;
+  }
+
+
+  void transorderdebt::setschema(uint8_t schema){
+    require_auth(get_self());
+
+    check( schema == 2, "only schema 2 can be selected" );
+
+    auto cfg = get_config();
+    check( cfg.schema < schema, "schema already selected" );
+
+    cfg.schema = schema;
+    cfg.legacy_rows = true;
+    config_singleton(get_self(), get_self().value).set(cfg, get_self());
+  }
+
+
+  void transorderdebt::setshard(uint8_t mode){
+    require_auth(get_self());
+
+    check( mode <= shard_by_month, "unknown shard mode" );
+
+    auto cfg = get_config();
+    check( cfg.schema >= 2, "select schema 2 before sharding" );
+
+    cfg.shard_mode.emplace(mode);
+    config_singleton(get_self(), get_self().value).set(cfg, get_self());
+  }
+
+
+  void transorderdebt::setretention(name table, uint32_t seconds){
+    require_auth(get_self());
+
+    retention_singleton retentions(get_self(), get_self().value);
+    auto policy = retentions.get_or_default();
+    retention_period(policy, table) = seconds;
+    retentions.set(policy, get_self());
+  }
+
+
+  void transorderdebt::prune(name table, block_timestamp before, uint32_t max_rows){
+    check( max_rows > 0, "max_rows must be positive" );
+
+    if( !has_auth(get_self()) ){
+      auto policy = retention_singleton(get_self(), get_self().value).get_or_default();
+      const uint32_t period = retention_period(policy, table);
+      check( period > 0, "table has no retention period" );
+      check( before.to_time_point() <= current_time_point() - eosio::seconds(period), "before lies inside the retention period" );
+    }
+
+    const auto cfg = get_config();
+    if( table == "orders"_n ){
+      prune_rows<order_tables>(cfg, before, max_rows);
+    }
+    else if( table == "debts"_n ){
+      prune_rows<debt_tables>(cfg, before, max_rows);
     }
     else{
-      debts.modify(*iterator, get_self(), [&](auto& row){
-        row.debt_id = debt_id;
-        row.debtor = debtor;
-        row.creditor = creditor;
-        row.quantity = quantity;
-        row.fee = fee;
-        row.profile.clear();
-        row.profile = profile;
-        row.timestamp = current_block_time();
-      });
+      check( table == "transrecords"_n, "unknown table" );
+      prune_rows<trans_tables>(cfg, before, max_rows);
     }
   }
 
 
-  void transorderdebt::debterase(uint128_t debt_id){
+  void transorderdebt::migrate(uint32_t max){
     require_auth(get_self());
 
-    debt_index debts(get_self(), get_self().value);
+    auto cfg = get_config();
+    check( cfg.schema >= 2, "select schema 2 before migrating" );
+    check( cfg.legacy_rows, "nothing to migrate" );
+    check( max > 0, "max must be positive" );
+
+    uint32_t moved = migrate_rows<trans_tables>(cfg, max);
+    if( moved < max ){
+      moved += migrate_rows<order_tables>(cfg, max - moved);
+    }
+    if( moved < max ){
+      moved += migrate_rows<debt_tables>(cfg, max - moved);
+    }
+
+    // every legacy table ran out of rows before the budget did
+    if( moved < max ){
+      cfg.legacy_rows = false;
+      config_singleton(get_self(), get_self().value).set(cfg, get_self());
+    }
+  }
 
-    auto debt_id_index = debts.get_index<name("bydebtid")>();
 
-    auto iterator = debt_id_index.find(debt_id);
+  void transorderdebt::linkrows(name table, uint64_t lower_bound, uint32_t max){
+    require_auth(get_self());
 
-    check(iterator != debt_id_index.end(), "Debt does not exist");
+    check( max > 0, "max must be positive" );
 
-    debt_id_index.erase(iterator);
+    if( table == "orders"_n ){
+      link_legacy<order_tables>(lower_bound, max);
+    }
+    else{
+      check( table == "debts"_n, "unknown table" );
+      link_legacy<debt_tables>(lower_bound, max);
+    }
   }
-};
\ No newline at end of file
+};
@@ -0,0 +1,167 @@
+#include <transorderdebt/hashed.hpp>
+
+#include <unit_test.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+
+namespace {
+
+   struct row {
+      uint64_t pkey = 0;
+      uint64_t id   = 0;
+
+      uint64_t primary_key() const { return pkey; }
+   };
+
+   /// the multi_index calls hashed.hpp relies on, over a std::map
+   class fake_table {
+      public:
+         struct const_iterator {
+            std::map<uint64_t, row>::const_iterator it;
+
+            const row& operator*() const { return it->second; }
+            const row* operator->() const { return &it->second; }
+            bool operator==( const const_iterator& other ) const { return it == other.it; }
+            bool operator!=( const const_iterator& other ) const { return it != other.it; }
+         };
+
+         const_iterator find( uint64_t pkey ) const { return { _rows.find( pkey ) }; }
+         const_iterator end() const { return { _rows.end() }; }
+
+         template<typename Constructor>
+         void emplace( int, Constructor&& constructor ) {
+            row r;
+            constructor( r );
+            UNIT_CHECK( _rows.count( r.pkey ) == 0 );
+            _rows[r.pkey] = r;
+         }
+
+         void erase( const_iterator iterator ) { _rows.erase( iterator.it ); }
+
+         const std::map<uint64_t, row>& rows() const { return _rows; }
+
+      private:
+         std::map<uint64_t, row> _rows;
+   };
+
+   /// ids share home slots in groups of `spread` starting at `base`, so probe runs are long
+   struct homes {
+      uint64_t base;
+      uint64_t spread;
+
+      uint64_t operator()( uint64_t id ) const { return base + id % spread; }
+      uint64_t operator()( const row& r ) const { return ( *this )( r.id ); }
+   };
+
+   auto find( const fake_table& table, const homes& home, uint64_t id ) {
+      return eosio::hashed::find( table, home( id ), [&]( const row& r ) { return r.id == id; } );
+   }
+
+   void insert( fake_table& table, const homes& home, uint64_t id ) {
+      auto slot = find( table, home, id );
+      UNIT_CHECK( slot.first == table.end() );
+      eosio::hashed::insert( table, 0, slot.second, row{ 0, id } );
+   }
+
+   void erase( fake_table& table, const homes& home, uint64_t id ) {
+      auto slot = find( table, home, id );
+      UNIT_CHECK( slot.first != table.end() );
+      eosio::hashed::erase( table, 0, slot.first, home );
+   }
+
+   /// every slot between a row's home and its own slot is taken, and every id is found
+   void check_runs( const fake_table& table, const homes& home, const std::set<uint64_t>& ids ) {
+      UNIT_CHECK( table.rows().size() == ids.size() );
+      for( const auto& entry : table.rows() ) {
+         for( uint64_t slot = home( entry.second ); slot != entry.first; ++slot )
+            UNIT_CHECK( table.find( slot ) != table.end() );
+      }
+      for( auto id : ids ) {
+         auto slot = find( table, home, id );
+         UNIT_CHECK( slot.first != table.end() && slot.first->id == id );
+      }
+   }
+
+   void colliding_rows() {
+      const homes home{ 1000, 1 };
+      fake_table  table;
+      std::set<uint64_t> ids;
+      for( uint64_t id = 1; id <= 8; ++id ) {
+         insert( table, home, id );
+         ids.insert( id );
+      }
+      check_runs( table, home, ids );
+
+      for( uint64_t id : { 4, 1, 8, 5 } ) {
+         erase( table, home, id );
+         ids.erase( id );
+         check_runs( table, home, ids );
+         UNIT_CHECK( find( table, home, id ).first == table.end() );
+      }
+      // the remaining run is packed from the home slot on
+      UNIT_CHECK( table.rows().begin()->first == 1000 && table.rows().rbegin()->first == 1003 );
+   }
+
+   void rows_after_the_hole_keep_their_home() {
+      // even ids have home slot 10, odd ids 11
+      const homes home{ 10, 2 };
+      fake_table  table;
+      for( uint64_t id : { 2, 1, 4, 3 } )
+         insert( table, home, id );
+      UNIT_CHECK( find( table, home, 4 ).second == 12 && find( table, home, 3 ).second == 13 );
+
+      // id 1 may not move before its home, ids 4 and 3 move back one hole each
+      erase( table, home, 2 );
+      UNIT_CHECK( find( table, home, 4 ).second == 10 );
+      UNIT_CHECK( find( table, home, 1 ).second == 11 );
+      UNIT_CHECK( find( table, home, 3 ).second == 12 );
+      check_runs( table, home, { 1, 3, 4 } );
+   }
+
+   void run_across_the_key_space_end() {
+      const homes home{ std::numeric_limits<uint64_t>::max() - 1, 1 };
+      fake_table  table;
+      std::set<uint64_t> ids;
+      for( uint64_t id = 1; id <= 5; ++id ) {
+         insert( table, home, id );
+         ids.insert( id );
+      }
+      UNIT_CHECK( find( table, home, 5 ).second == 2 );
+
+      erase( table, home, 2 );
+      ids.erase( 2 );
+      check_runs( table, home, ids );
+      UNIT_CHECK( find( table, home, 5 ).second == 1 );
+   }
+
+   void random_operations() {
+      std::mt19937_64 rng( 7 );
+      const homes home{ std::numeric_limits<uint64_t>::max() - 8, 24 };
+      fake_table  table;
+      std::set<uint64_t> ids;
+      for( int step = 0; step < 4000; ++step ) {
+         const uint64_t id = rng() % 64;
+         if( ids.count( id ) ) {
+            erase( table, home, id );
+            ids.erase( id );
+         } else {
+            insert( table, home, id );
+            ids.insert( id );
+         }
+         check_runs( table, home, ids );
+      }
+   }
+
+} /// namespace
+
+int main() {
+   colliding_rows();
+   rows_after_the_hole_keep_their_home();
+   run_across_the_key_space_end();
+   random_operations();
+   return unit_test::failures();
+}
@@ -0,0 +1,88 @@
+#include <eosio.msig/lz.hpp>
+
+#include <unit_test.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+   std::vector<char> round_trip( const std::vector<char>& data ) {
+      const auto packed = eosio::lz::compress( data.data(), data.size() );
+      const auto out    = eosio::lz::decompress( packed.data(), packed.size() );
+      UNIT_CHECK( out == data );
+      return packed;
+   }
+
+   std::vector<char> random_bytes( size_t size, uint32_t seed ) {
+      std::mt19937 rng( seed );
+      std::vector<char> data( size );
+      for( auto& c : data )
+         c = char( rng() );
+      return data;
+   }
+
+   void round_trips() {
+      round_trip( {} );
+      round_trip( { 'a' } );
+      round_trip( { 'a', 'b', 'c', 'a' } );
+
+      const std::string text = "eosio.msig stores proposed transactions, proposed transactions are stored";
+      round_trip( std::vector<char>( text.begin(), text.end() ) );
+
+      // literal and match lengths continued over several 255 bytes
+      round_trip( random_bytes( 1000, 1 ) );
+      UNIT_CHECK( round_trip( std::vector<char>( 5000, 'x' ) ).size() < 40 );
+
+      // overlapping matches with a short period
+      std::vector<char> pattern;
+      for( int i = 0; i < 3000; ++i )
+         pattern.push_back( "abc"[i % 3] );
+      round_trip( pattern );
+   }
+
+   void far_repeats() {
+      // the second copy lies beyond max_offset, the third within reach of the second
+      const auto block = random_bytes( 40000, 2 );
+      std::vector<char> data( block );
+      data.insert( data.end(), 30000, '\0' );
+      data.insert( data.end(), block.begin(), block.end() );
+      data.insert( data.end(), block.begin(), block.end() );
+      UNIT_CHECK( round_trip( data ).size() < data.size() - block.size() );
+   }
+
+   void corrupted_input() {
+      const std::string text( 300, 'q' );
+      const auto packed = eosio::lz::compress( text.data(), text.size() );
+
+      // the closing sequence without literals carries no data, every shorter prefix is incomplete
+      UNIT_CHECK( packed.back() == 0 );
+      for( size_t size = 1; size + 1 < packed.size(); ++size )
+         UNIT_CHECK_THROW( eosio::lz::decompress( packed.data(), size ) );
+
+      // offset 0 and offsets before the start of the output
+      auto bad = packed;
+      const size_t offset_at = 2 + 1 + 1; // size, token, literal
+      UNIT_CHECK( uint8_t(bad[offset_at]) == 1 && bad[offset_at + 1] == 0 );
+      bad[offset_at] = 0;
+      UNIT_CHECK_THROW( eosio::lz::decompress( bad.data(), bad.size() ) );
+      bad[offset_at] = 2;
+      UNIT_CHECK_THROW( eosio::lz::decompress( bad.data(), bad.size() ) );
+
+      // declared size smaller and larger than the data
+      bad = packed;
+      bad[0] = char( uint8_t(bad[0]) - 1 );
+      UNIT_CHECK_THROW( eosio::lz::decompress( bad.data(), bad.size() ) );
+      bad[0] = char( uint8_t(bad[0]) + 2 );
+      UNIT_CHECK_THROW( eosio::lz::decompress( bad.data(), bad.size() ) );
+   }
+
+} /// namespace
+
+int main() {
+   round_trips();
+   far_repeats();
+   corrupted_input();
+   return unit_test::failures();
+}
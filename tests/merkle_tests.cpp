@@ -0,0 +1,104 @@
+#include <transorderdebt/merkle.hpp>
+
+#include <unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+   using eosio::checksum256;
+   namespace merkle = eosio::merkle;
+
+   std::vector<checksum256> leaves( uint32_t count ) {
+      std::vector<checksum256> result;
+      for( uint64_t i = 0; i < count; ++i )
+         result.push_back( merkle::leaf_hash( i * 7919 ) );
+      return result;
+   }
+
+   /// the siblings of leaf `index` from the bottom level up, as a client builds them
+   std::vector<checksum256> proof_of( std::vector<checksum256> level, uint32_t index ) {
+      std::vector<checksum256> proof;
+      for( ; level.size() > 1; index /= 2 ) {
+         const uint32_t sibling = index ^ 1;
+         if( sibling < level.size() )
+            proof.push_back( level[sibling] );
+         std::vector<checksum256> next;
+         for( size_t i = 0; i < level.size(); i += 2 )
+            next.push_back( i + 1 < level.size() ? merkle::node_hash( level[i], level[i + 1] ) : level[i] );
+         level = next;
+      }
+      return proof;
+   }
+
+   std::string hex( const checksum256& hash ) {
+      std::string out;
+      for( auto b : hash.extract_as_byte_array() ) {
+         out += "0123456789abcdef"[b >> 4];
+         out += "0123456789abcdef"[b & 15];
+      }
+      return out;
+   }
+
+   void stub_digest() {
+      const char* abc = "abc";
+      UNIT_CHECK( hex( eosio::sha256( abc, 3 ) ) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" );
+      const std::string two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+      UNIT_CHECK( hex( eosio::sha256( two_blocks.data(), two_blocks.size() ) ) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" );
+   }
+
+   void tree_shape() {
+      const auto l = leaves( 5 );
+      UNIT_CHECK( merkle::root( { l[0] } ) == l[0] );
+      UNIT_CHECK( merkle::root( { l[0], l[1], l[2] } ) == merkle::node_hash( merkle::node_hash( l[0], l[1] ), l[2] ) );
+      UNIT_CHECK( merkle::root( l ) == merkle::node_hash( merkle::node_hash( merkle::node_hash( l[0], l[1] ),
+                                                                             merkle::node_hash( l[2], l[3] ) ), l[4] ) );
+      UNIT_CHECK_THROW( merkle::root( {} ) );
+
+      // leaves and nodes hash the same bytes under different prefixes
+      char node_bytes[65] = { 1 };
+      UNIT_CHECK( merkle::node_hash( checksum256{}, checksum256{} ) == eosio::sha256( node_bytes, sizeof(node_bytes) ) );
+      char leaf_bytes[9] = {};
+      UNIT_CHECK( merkle::leaf_hash( uint64_t(0) ) == eosio::sha256( leaf_bytes, sizeof(leaf_bytes) ) );
+   }
+
+   void proofs() {
+      for( uint32_t count = 1; count <= 17; ++count ) {
+         const auto l    = leaves( count );
+         const auto root = merkle::root( l );
+         for( uint32_t index = 0; index < count; ++index ) {
+            auto proof = proof_of( l, index );
+            UNIT_CHECK( merkle::root_from_proof( l[index], index, count, proof ) == root );
+
+            // another leaf, or the right leaf at another position, gives another root
+            UNIT_CHECK( merkle::root_from_proof( l[( index + 1 ) % count], index, count, proof ) != root || count == 1 );
+            if( count > 1 && proof.size() == proof_of( l, ( index + 1 ) % count ).size() )
+               UNIT_CHECK( merkle::root_from_proof( l[index], ( index + 1 ) % count, count, proof ) != root );
+
+            if( !proof.empty() ) {
+               auto tampered = proof;
+               tampered.back() = l[index];
+               UNIT_CHECK( merkle::root_from_proof( l[index], index, count, tampered ) != root );
+
+               auto shorter = proof;
+               shorter.pop_back();
+               UNIT_CHECK_THROW( merkle::root_from_proof( l[index], index, count, shorter ) );
+            }
+
+            auto longer = proof;
+            longer.push_back( l[0] );
+            UNIT_CHECK_THROW( merkle::root_from_proof( l[index], index, count, longer ) );
+         }
+         UNIT_CHECK_THROW( merkle::root_from_proof( l[0], count, count, proof_of( l, 0 ) ) );
+      }
+   }
+
+} /// namespace
+
+int main() {
+   stub_digest();
+   tree_shape();
+   proofs();
+   return unit_test::failures();
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdexcept>
+
+namespace eosio {
+
+   /// native stand-in for the chain's assertion, a failed check throws
+   inline void check( bool pred, const char* msg ) {
+      if( !pred )
+         throw std::runtime_error( msg );
+   }
+
+} /// namespace eosio
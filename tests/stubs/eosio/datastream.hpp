@@ -0,0 +1,108 @@
+#pragma once
+#include <eosio/check.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace eosio {
+
+   /// native stand-in for the cdt datastream, enough for the headers under test
+   template<typename T>
+   class datastream {
+      public:
+         datastream( T start, size_t size ) : _start( start ), _pos( start ), _end( start + size ) {}
+
+         void read( char* d, size_t s ) {
+            check( size_t(_end - _pos) >= s, "read" );
+            memcpy( d, _pos, s );
+            _pos += s;
+         }
+
+         void write( const char* d, size_t s ) {
+            check( size_t(_end - _pos) >= s, "write" );
+            memcpy( _pos, d, s );
+            _pos += s;
+         }
+
+         T pos() const { return _pos; }
+         size_t tellp() const { return size_t(_pos - _start); }
+
+      private:
+         T _start;
+         T _pos;
+         T _end;
+   };
+
+   template<>
+   class datastream<size_t> {
+      public:
+         datastream( size_t init_size = 0 ) : _size( init_size ) {}
+         void write( const char*, size_t s ) { _size += s; }
+         size_t tellp() const { return _size; }
+
+      private:
+         size_t _size;
+   };
+
+   struct unsigned_int {
+      uint32_t value = 0;
+   };
+
+   template<typename Stream, typename T, std::enable_if_t<std::is_arithmetic<T>::value, int> = 0>
+   Stream& operator<<( Stream& ds, const T& v ) {
+      ds.write( reinterpret_cast<const char*>( &v ), sizeof(v) );
+      return ds;
+   }
+
+   template<typename Stream, typename T, std::enable_if_t<std::is_arithmetic<T>::value, int> = 0>
+   Stream& operator>>( Stream& ds, T& v ) {
+      ds.read( reinterpret_cast<char*>( &v ), sizeof(v) );
+      return ds;
+   }
+
+   template<typename Stream>
+   Stream& operator<<( Stream& ds, const unsigned_int& v ) {
+      uint64_t val = v.value;
+      do {
+         uint8_t b = uint8_t(val) & 0x7f;
+         val >>= 7;
+         b |= uint8_t( val > 0 ) << 7;
+         ds.write( reinterpret_cast<const char*>( &b ), 1 );
+      } while( val );
+      return ds;
+   }
+
+   template<typename Stream>
+   Stream& operator>>( Stream& ds, unsigned_int& v ) {
+      uint64_t val = 0;
+      uint8_t  b   = 0;
+      uint8_t  by  = 0;
+      do {
+         char c;
+         ds.read( &c, 1 );
+         b = uint8_t(c);
+         val |= uint64_t( b & 0x7f ) << by;
+         by += 7;
+      } while( ( b & 0x80 ) && by < 32 );
+      v.value = uint32_t(val);
+      return ds;
+   }
+
+   template<typename T>
+   size_t pack_size( const T& value ) {
+      datastream<size_t> ps;
+      ps << value;
+      return ps.tellp();
+   }
+
+   template<typename T>
+   std::vector<char> pack( const T& value ) {
+      std::vector<char> result( pack_size( value ) );
+      datastream<char*> ds( result.data(), result.size() );
+      ds << value;
+      return result;
+   }
+
+} /// namespace eosio
@@ -0,0 +1,3 @@
+#pragma once
+#include <eosio/check.hpp>
+#include <eosio/datastream.hpp>
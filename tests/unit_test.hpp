@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdio>
+#include <exception>
+#include <string>
+
+/**
+ * Minimal assertions for the native unit tests, each test executable returns the failure count.
+ */
+namespace unit_test {
+
+   inline int& failures() {
+      static int count = 0;
+      return count;
+   }
+
+   inline void fail( const char* file, int line, const std::string& what ) {
+      std::fprintf( stderr, "%s:%d: %s\n", file, line, what.c_str() );
+      ++failures();
+   }
+
+} /// namespace unit_test
+
+#define UNIT_CHECK( expr ) \
+   do { if( !(expr) ) unit_test::fail( __FILE__, __LINE__, "check failed: " #expr ); } while( 0 )
+
+#define UNIT_CHECK_THROW( expr ) \
+   do { \
+      bool thrown = false; \
+      try { expr; } catch( const std::exception& ) { thrown = true; } \
+      if( !thrown ) unit_test::fail( __FILE__, __LINE__, "no exception: " #expr ); \
+   } while( 0 )
@@ -0,0 +1,648 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ *
+ *  Streams binary contract table rows out as newline delimited JSON or CSV.
+ *
+ *  Input is either a nodeos snapshot, from which every row of one table of one contract is
+ *  exported with its scope, or text holding one row per line: a hex string or a page returned
+ *  by get_table_rows with "json": false, compacted to one line (for example with `jq -c`).
+ *  Rows are decoded and written one at a time, so memory use is bounded by the largest row
+ *  or input line no matter how large the table is.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+   __extension__ typedef unsigned __int128 uint128;
+
+   struct decode_error : std::runtime_error {
+      using std::runtime_error::runtime_error;
+   };
+
+   /**
+    *  Reads values in the contract serialization format.
+    */
+   class reader {
+      public:
+         reader( const std::vector<char>& data ) : _pos( data.data() ), _end( data.data() + data.size() ) {}
+
+         bool remaining()const { return _pos < _end; }
+
+         template<typename T>
+         T read() {
+            T value;
+            memcpy( &value, take( sizeof(value) ), sizeof(value) );
+            return value;
+         }
+
+         uint32_t read_varuint32() {
+            uint32_t value = 0;
+            for( int shift = 0; ; shift += 7 ) {
+               if( shift > 28 )
+                  throw decode_error( "varuint32 too long" );
+               const uint8_t b = read<uint8_t>();
+               value |= uint32_t( b & 0x7f ) << shift;
+               if( !(b & 0x80) )
+                  return value;
+            }
+         }
+
+         std::string read_string() {
+            const uint32_t size = read_varuint32();
+            return std::string( take( size ), size );
+         }
+
+         const char* take( size_t size ) {
+            if( size_t(_end - _pos) < size )
+               throw decode_error( "row is truncated" );
+            const char* p = _pos;
+            _pos += size;
+            return p;
+         }
+
+      private:
+         const char* _pos;
+         const char* _end;
+   };
+
+   /**
+    *  One decoded row: column names with their values, either JSON text or plain strings.
+    */
+   struct field {
+      std::string name;
+      std::string text;
+      bool        quoted = false;
+      bool        null   = false;
+   };
+
+   using row = std::vector<field>;
+
+   std::string json_escape( const std::string& s ) {
+      std::string out;
+      out.reserve( s.size() + 2 );
+      out += '"';
+      for( unsigned char c : s ) {
+         switch( c ) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+               if( c < 0x20 ) {
+                  char buf[8];
+                  snprintf( buf, sizeof(buf), "\\u%04x", c );
+                  out += buf;
+               } else {
+                  out += char(c);
+               }
+         }
+      }
+      out += '"';
+      return out;
+   }
+
+   std::string csv_escape( const std::string& s ) {
+      if( s.find_first_of( ",\"\r\n" ) == std::string::npos )
+         return s;
+      std::string out = "\"";
+      for( char c : s ) {
+         if( c == '"' )
+            out += '"';
+         out += c;
+      }
+      return out + "\"";
+   }
+
+   std::string name_to_string( uint64_t value ) {
+      static const char* charmap = ".12345abcdefghijklmnopqrstuvwxyz";
+      std::string str( 13, '.' );
+      for( uint32_t i = 0; i <= 12; ++i ) {
+         str[12 - i] = charmap[value & (i == 0 ? 0x0f : 0x1f)];
+         value >>= (i == 0 ? 4 : 5);
+      }
+      str.erase( str.find_last_not_of( '.' ) + 1 );
+      return str;
+   }
+
+   uint64_t string_to_name( const std::string& str ) {
+      auto char_to_value = [&]( char c ) -> uint64_t {
+         if( c == '.' ) return 0;
+         if( c >= '1' && c <= '5' ) return uint64_t(c - '1') + 1;
+         if( c >= 'a' && c <= 'z' ) return uint64_t(c - 'a') + 6;
+         throw decode_error( "invalid character in name " + str );
+      };
+      if( str.size() > 13 )
+         throw decode_error( "name " + str + " is longer than 13 characters" );
+
+      uint64_t value = 0;
+      for( size_t i = 0; i < str.size() && i < 12; ++i )
+         value |= (char_to_value( str[i] ) & 0x1f) << (64 - 5 * (i + 1));
+      if( str.size() == 13 ) {
+         const uint64_t last = char_to_value( str[12] );
+         if( last > 0x0f )
+            throw decode_error( "last character of name " + str + " is out of range" );
+         value |= last;
+      }
+      return value;
+   }
+
+   std::string asset_to_string( int64_t amount, uint64_t symbol ) {
+      const uint8_t precision = symbol & 0xff;
+      std::string code;
+      for( uint64_t s = symbol >> 8; s & 0xff; s >>= 8 )
+         code += char(s & 0xff);
+
+      const bool negative = amount < 0;
+      const uint64_t magnitude = negative ? 0 - uint64_t(amount) : uint64_t(amount);
+      uint64_t p10 = 1;
+      for( uint8_t i = 0; i < precision; ++i )
+         p10 *= 10;
+
+      std::string out = (negative ? "-" : "") + std::to_string( magnitude / p10 );
+      if( precision ) {
+         std::string fraction = std::to_string( magnitude % p10 );
+         out += '.' + std::string( precision - fraction.size(), '0' ) + fraction;
+      }
+      return out + ' ' + code;
+   }
+
+   std::string uint128_to_string( uint128 value ) {
+      if( value == 0 )
+         return "0";
+      std::string out;
+      for( ; value; value /= 10 )
+         out.insert( out.begin(), char('0' + int(value % 10)) );
+      return out;
+   }
+
+   std::string hex( const char* data, size_t size ) {
+      static const char* digits = "0123456789abcdef";
+      std::string out;
+      out.reserve( size * 2 );
+      for( size_t i = 0; i < size; ++i ) {
+         out += digits[uint8_t(data[i]) >> 4];
+         out += digits[uint8_t(data[i]) & 0x0f];
+      }
+      return out;
+   }
+
+   /// block_timestamp slots are 500 ms since 2000-01-01T00:00:00
+   std::string block_time_to_string( uint32_t slot ) {
+      const uint64_t ms = uint64_t(slot) * 500 + 946684800000ull;
+      const time_t secs = time_t(ms / 1000);
+      tm t;
+      gmtime_r( &secs, &t );
+      char buf[32];
+      strftime( buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &t );
+      snprintf( buf + strlen(buf), sizeof(buf) - strlen(buf), ".%03u", unsigned(ms % 1000) );
+      return buf;
+   }
+
+   /**
+    *  Appends fields to a row, one method per serialized type.
+    */
+   struct row_builder {
+      reader& r;
+      row&    out;
+
+      void plain( const char* name, std::string text ) { out.push_back( { name, std::move(text), false, false } ); }
+      void quoted( const char* name, std::string text ) { out.push_back( { name, std::move(text), true, false } ); }
+      void null( const char* name ) { out.push_back( { name, "null", false, true } ); }
+
+      void u32( const char* name )     { plain( name, std::to_string( r.read<uint32_t>() ) ); }
+      // 64 and 128 bit integers are quoted like nodeos does, they exceed the range of JSON numbers
+      void u64( const char* name )     { quoted( name, std::to_string( r.read<uint64_t>() ) ); }
+      void u128( const char* name )    { quoted( name, uint128_to_string( r.read<uint128>() ) ); }
+      void account( const char* name ) { quoted( name, name_to_string( r.read<uint64_t>() ) ); }
+      void str( const char* name )     { quoted( name, r.read_string() ); }
+      void time( const char* name )    { quoted( name, block_time_to_string( r.read<uint32_t>() ) ); }
+      void sha256( const char* name )  { quoted( name, hex( r.take( 32 ), 32 ) ); }
+
+      void asset( const char* name ) {
+         const int64_t amount = r.read<int64_t>();
+         quoted( name, asset_to_string( amount, r.read<uint64_t>() ) );
+      }
+
+      void string_map( const char* name ) {
+         std::string text = "{";
+         for( uint32_t n = r.read_varuint32(), i = 0; i < n; ++i ) {
+            if( i )
+               text += ',';
+            text += json_escape( r.read_string() );
+            text += ':';
+            text += json_escape( r.read_string() );
+         }
+         plain( name, text + "}" );
+      }
+
+      /// binary_extension<uint64_t>
+      void optional_u64( const char* name ) {
+         if( r.remaining() )
+            u64( name );
+         else
+            null( name );
+      }
+   };
+
+   // row layouts, kept in sync with the table structs of the contracts
+
+   /// transorderdebt::transrecord (transrecords, transrecs2)
+   void decode_transrecord( row_builder& b ) {
+      b.u64( "pkey" );
+      b.sha256( "trans_id" );
+      b.account( "from" );
+      b.account( "to" );
+      b.asset( "quantity" );
+      b.str( "memo" );
+      b.asset( "fee" );
+      b.time( "timestamp" );
+   }
+
+   /// transorderdebt::order (orders, orders2)
+   void decode_order( row_builder& b ) {
+      b.u64( "pkey" );
+      b.u128( "order_id" );
+      b.account( "account" );
+      b.str( "logistics" );
+      b.str( "goods_info" );
+      b.account( "merchant" );
+      b.time( "timestamp" );
+      b.optional_u64( "logistics_ref" );
+      b.optional_u64( "goods_ref" );
+   }
+
+   /// transorderdebt::debt (debts, debts2)
+   void decode_debt( row_builder& b ) {
+      b.u64( "pkey" );
+      b.u128( "debt_id" );
+      b.account( "debtor" );
+      b.account( "creditor" );
+      b.asset( "quantity" );
+      b.asset( "fee" );
+      b.string_map( "profile" );
+      b.time( "timestamp" );
+      if( !b.r.remaining() ) {
+         b.null( "compact_profile" );
+         return;
+      }
+      // binary_extension<vector<profile_field>> as [[key_id, value], ...]
+      std::string text = "[";
+      for( uint32_t n = b.r.read_varuint32(), i = 0; i < n; ++i ) {
+         if( i )
+            text += ',';
+         text += '[' + std::to_string( b.r.read_varuint32() ) + ',';
+         text += json_escape( b.r.read_string() ) + ']';
+      }
+      b.plain( "compact_profile", text + "]" );
+   }
+
+   /// transorderdebt::profile_key (profilekeys)
+   void decode_profile_key( row_builder& b ) {
+      b.u64( "id" );
+      b.str( "key" );
+   }
+
+   /// transorderdebt::blob (blobs)
+   void decode_blob( row_builder& b ) {
+      b.u64( "id" );
+      b.str( "data" );
+      b.u32( "refs" );
+   }
+
+   /// eosio::token::account (accounts)
+   void decode_account( row_builder& b ) {
+      b.asset( "balance" );
+   }
+
+   /// eosio::token::currency_stats (stat)
+   void decode_stat( row_builder& b ) {
+      b.asset( "supply" );
+      b.asset( "max_supply" );
+      b.account( "issuer" );
+   }
+
+   using decoder = void (*)( row_builder& );
+
+   const std::map<std::string, decoder> decoders = {
+      { "transrecords", decode_transrecord },
+      { "transrecs2",   decode_transrecord },
+      { "orders",       decode_order },
+      { "orders2",      decode_order },
+      { "debts",        decode_debt },
+      { "debts2",       decode_debt },
+      { "profilekeys",  decode_profile_key },
+      { "blobs",        decode_blob },
+      { "accounts",     decode_account },
+      { "stat",         decode_stat },
+   };
+
+   int hex_digit( char c ) {
+      if( c >= '0' && c <= '9' ) return c - '0';
+      if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+      if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+      return -1;
+   }
+
+   std::vector<char> from_hex( const std::string& text ) {
+      if( text.size() % 2 )
+         throw decode_error( "odd number of hex digits" );
+      std::vector<char> data( text.size() / 2 );
+      for( size_t i = 0; i < data.size(); ++i ) {
+         const int hi = hex_digit( text[2 * i] ), lo = hex_digit( text[2 * i + 1] );
+         if( hi < 0 || lo < 0 )
+            throw decode_error( "invalid hex digit" );
+         data[i] = char( (hi << 4) | lo );
+      }
+      return data;
+   }
+
+   /**
+    *  Extracts the hex rows of a get_table_rows page: "rows" holds strings, or objects with a
+    *  "data" string when the payer was requested.
+    */
+   std::vector<std::string> page_rows( const std::string& line ) {
+      std::vector<std::string> rows;
+      size_t pos = line.find( "\"rows\"" );
+      if( pos == std::string::npos || (pos = line.find( '[', pos )) == std::string::npos )
+         throw decode_error( "page has no rows array" );
+
+      auto read_string = [&]( size_t start ) {
+         const size_t close = line.find( '"', start + 1 );
+         if( close == std::string::npos )
+            throw decode_error( "unterminated string" );
+         rows.push_back( line.substr( start + 1, close - start - 1 ) );
+         return close + 1;
+      };
+
+      for( ++pos; pos < line.size(); ) {
+         const char c = line[pos];
+         if( c == ']' )
+            return rows;
+         if( c == '"' ) {
+            pos = read_string( pos );
+         } else if( c == '{' ) {
+            const size_t close = line.find( '}', pos );
+            const size_t data  = line.find( "\"data\"", pos );
+            if( close == std::string::npos || data == std::string::npos || data > close )
+               throw decode_error( "row object has no data" );
+            read_string( line.find( '"', line.find( ':', data ) ) );
+            pos = close + 1;
+         } else {
+            ++pos;
+         }
+      }
+      throw decode_error( "unterminated rows array" );
+   }
+
+   /**
+    *  Reads the contract_tables section of a snapshot written by nodeos (producer_api
+    *  create_snapshot). Other sections are skipped without being decoded.
+    *
+    *  The file starts with a magic number and a version (uint32 each). Sections follow, each
+    *  being its size (uint64, counting the bytes after this field), a row count (uint64) and a
+    *  null terminated name followed by the rows; a size of 2^64-1 ends the file. In
+    *  contract_tables, every table_id row (code, scope, table, payer, uint32 count) is followed
+    *  by a varuint32 count and the rows of, in order, the primary index (primary key, payer,
+    *  varuint32 length prefixed value) and the idx64, idx128, idx256, idx_double and
+    *  idx_long_double secondary indexes (primary key, payer, key of 8, 16, 32, 8 and 16 bytes).
+    */
+   class snapshot_reader {
+      public:
+         static constexpr uint32_t magic_number = 0x30510550;
+
+         explicit snapshot_reader( std::istream& in ) : _in( in ) {}
+
+         /// calls `f( scope, value )` for every row of `table` owned by `code`
+         void for_each_row( uint64_t code, uint64_t table, const std::function<void( uint64_t, const std::vector<char>& )>& f ) {
+            if( read<uint32_t>() != magic_number )
+               throw decode_error( "not a snapshot" );
+            read<uint32_t>();   // version, the sections read here are laid out alike in every version
+
+            std::vector<char> value;
+            for( ;; ) {
+               const uint64_t size = read<uint64_t>();
+               if( size == uint64_t(-1) )
+                  throw decode_error( "snapshot has no contract_tables section" );
+               const uint64_t end = _consumed + size;
+               read<uint64_t>();   // row count
+               std::string name;
+               for( char c; (c = read<char>()) != 0; )
+                  name += c;
+
+               if( name != "contract_tables" ) {
+                  skip( end - _consumed );
+                  continue;
+               }
+
+               while( _consumed < end ) {
+                  const uint64_t table_code  = read<uint64_t>();
+                  const uint64_t table_scope = read<uint64_t>();
+                  const uint64_t table_name  = read<uint64_t>();
+                  read<uint64_t>();   // payer
+                  read<uint32_t>();   // row count
+                  const bool wanted = table_code == code && table_name == table;
+
+                  for( uint32_t n = read_varuint32(); n; --n ) {
+                     read<uint64_t>();   // primary key
+                     read<uint64_t>();   // payer
+                     const uint32_t length = read_varuint32();
+                     if( !wanted ) {
+                        skip( length );
+                        continue;
+                     }
+                     value.resize( length );
+                     read_bytes( value.data(), length );
+                     f( table_scope, value );
+                  }
+                  for( uint32_t key_size : { 8, 16, 32, 8, 16 } )
+                     skip( uint64_t(read_varuint32()) * (16 + key_size) );
+               }
+               if( _consumed != end )
+                  throw decode_error( "contract_tables section is corrupted" );
+               return;
+            }
+         }
+
+      private:
+         template<typename T>
+         T read() {
+            T value;
+            read_bytes( reinterpret_cast<char*>( &value ), sizeof(value) );
+            return value;
+         }
+
+         uint32_t read_varuint32() {
+            uint32_t value = 0;
+            for( int shift = 0; ; shift += 7 ) {
+               if( shift > 28 )
+                  throw decode_error( "varuint32 too long" );
+               const uint8_t b = read<uint8_t>();
+               value |= uint32_t( b & 0x7f ) << shift;
+               if( !(b & 0x80) )
+                  return value;
+            }
+         }
+
+         void read_bytes( char* data, size_t size ) {
+            if( !_in.read( data, size ) )
+               throw decode_error( "snapshot is truncated" );
+            _consumed += size;
+         }
+
+         void skip( uint64_t size ) {
+            for( ; size; ) {
+               const auto step = std::streamsize( std::min<uint64_t>( size, 1 << 30 ) );
+               if( !_in.ignore( step ) || _in.gcount() != step )
+                  throw decode_error( "snapshot is truncated" );
+               size -= step;
+               _consumed += step;
+            }
+         }
+
+         std::istream& _in;
+         uint64_t      _consumed = 0;
+   };
+
+   class output {
+      public:
+         output( std::ostream& out, bool csv ) : _out( out ), _csv( csv ) {}
+
+         void write( const row& fields ) {
+            if( !_csv ) {
+               _out << '{';
+               for( size_t i = 0; i < fields.size(); ++i ) {
+                  if( i )
+                     _out << ',';
+                  _out << json_escape( fields[i].name ) << ':'
+                       << (fields[i].quoted ? json_escape( fields[i].text ) : fields[i].text);
+               }
+               _out << "}\n";
+               return;
+            }
+
+            if( !_header_written ) {
+               for( size_t i = 0; i < fields.size(); ++i )
+                  _out << (i ? "," : "") << fields[i].name;
+               _out << '\n';
+               _header_written = true;
+            }
+            for( size_t i = 0; i < fields.size(); ++i )
+               _out << (i ? "," : "") << (fields[i].null ? "" : csv_escape( fields[i].text ));
+            _out << '\n';
+         }
+
+      private:
+         std::ostream& _out;
+         bool          _csv;
+         bool          _header_written = false;
+   };
+
+   int usage( const char* argv0 ) {
+      std::cerr << "usage: " << argv0 << " --table <table> [--format ndjson|csv] [input]\n"
+                << "       " << argv0 << " --table <table> [--format ndjson|csv] --snapshot <file> --code <account>\n"
+                << "tables:";
+      for( const auto& d : decoders )
+         std::cerr << ' ' << d.first;
+      std::cerr << "\nreads standard input when no input file is given\n";
+      return 2;
+   }
+
+} /// namespace
+
+int main( int argc, char** argv ) {
+   std::string table, format = "ndjson", input, snapshot, code;
+   for( int i = 1; i < argc; ++i ) {
+      const std::string arg = argv[i];
+      if( arg == "--table" && i + 1 < argc )
+         table = argv[++i];
+      else if( arg == "--format" && i + 1 < argc )
+         format = argv[++i];
+      else if( arg == "--snapshot" && i + 1 < argc )
+         snapshot = argv[++i];
+      else if( arg == "--code" && i + 1 < argc )
+         code = argv[++i];
+      else if( arg.size() && arg[0] != '-' && input.empty() )
+         input = arg;
+      else
+         return usage( argv[0] );
+   }
+
+   const auto d = decoders.find( table );
+   if( d == decoders.end() || (format != "ndjson" && format != "csv") )
+      return usage( argv[0] );
+   if( snapshot.empty() != code.empty() || (!snapshot.empty() && !input.empty()) )
+      return usage( argv[0] );
+
+   std::ios::sync_with_stdio( false );
+   output out( std::cout, format == "csv" );
+
+   auto emit = [&]( const std::vector<char>& data, const uint64_t* scope ) {
+      reader r( data );
+      row fields;
+      row_builder b{ r, fields };
+      if( scope )
+         b.quoted( "scope", name_to_string( *scope ) );
+      d->second( b );
+      if( r.remaining() )
+         throw decode_error( "unexpected bytes after row" );
+      out.write( fields );
+   };
+
+   if( !snapshot.empty() ) {
+      std::ifstream file( snapshot, std::ios::binary );
+      if( !file ) {
+         std::cerr << "cannot open " << snapshot << '\n';
+         return 1;
+      }
+      try {
+         snapshot_reader( file ).for_each_row( string_to_name( code ), string_to_name( table ),
+                                               [&]( uint64_t scope, const std::vector<char>& data ) { emit( data, &scope ); } );
+      } catch( const decode_error& e ) {
+         std::cerr << snapshot << ": " << e.what() << '\n';
+         return 1;
+      }
+      return 0;
+   }
+
+   std::ifstream file;
+   if( !input.empty() ) {
+      file.open( input );
+      if( !file ) {
+         std::cerr << "cannot open " << input << '\n';
+         return 1;
+      }
+   }
+   std::istream& in = input.empty() ? std::cin : file;
+
+   std::string line;
+   for( uint64_t line_number = 1; std::getline( in, line ); ++line_number ) {
+      const size_t start = line.find_first_not_of( " \t\r" );
+      if( start == std::string::npos || line[start] == '#' )
+         continue;
+      try {
+         if( line[start] == '{' ) {
+            for( const auto& text : page_rows( line ) )
+               emit( from_hex( text ), nullptr );
+         } else {
+            emit( from_hex( line.substr( start, line.find_last_not_of( " \t\r" ) + 1 - start ) ), nullptr );
+         }
+      } catch( const decode_error& e ) {
+         std::cerr << (input.empty() ? "<stdin>" : input) << ':' << line_number << ": " << e.what() << '\n';
+         return 1;
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ *
+ *  Writes the inputs of the table-export round trip test: rows serialized like the contracts
+ *  store them, as hex lines, as a get_table_rows page and inside a snapshot.
+ */
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+   using bytes = std::vector<char>;
+
+   template<typename T>
+   void put( bytes& out, const T& value ) {
+      const char* p = reinterpret_cast<const char*>( &value );
+      out.insert( out.end(), p, p + sizeof(value) );
+   }
+
+   void put_varuint32( bytes& out, uint32_t value ) {
+      do {
+         uint8_t b = value & 0x7f;
+         value >>= 7;
+         out.push_back( char( b | (value ? 0x80 : 0) ) );
+      } while( value );
+   }
+
+   void put_string( bytes& out, const std::string& s ) {
+      put_varuint32( out, uint32_t(s.size()) );
+      out.insert( out.end(), s.begin(), s.end() );
+   }
+
+   uint64_t name( const std::string& str ) {
+      uint64_t value = 0;
+      for( size_t i = 0; i < str.size(); ++i ) {
+         const char c = str[i];
+         const uint64_t v = c == '.' ? 0 : (c >= '1' && c <= '5') ? uint64_t(c - '1') + 1 : uint64_t(c - 'a') + 6;
+         value |= (v & 0x1f) << (64 - 5 * (i + 1));
+      }
+      return value;
+   }
+
+   uint64_t symbol( uint8_t precision, const std::string& code ) {
+      uint64_t value = 0;
+      for( size_t i = code.size(); i-- > 0; )
+         value = (value << 8) | uint8_t(code[i]);
+      return (value << 8) | precision;
+   }
+
+   void put_asset( bytes& out, int64_t amount, uint64_t sym ) {
+      put( out, amount );
+      put( out, sym );
+   }
+
+   /// transorderdebt::order, written with or without the blob references
+   bytes order_row( uint64_t pkey, uint64_t order_id_low, const std::string& logistics, bool refs ) {
+      bytes out;
+      put( out, pkey );
+      put( out, order_id_low );
+      put( out, uint64_t(1) );   // high half of the uint128 order id
+      put( out, name( "alice" ) );
+      put_string( out, logistics );
+      put_string( out, "3 x \"crate\"" );
+      put( out, name( "shop.bob" ) );
+      put( out, uint32_t(1000000000) );
+      if( refs ) {
+         put( out, uint64_t(7) );
+         put( out, uint64_t(0) );
+      }
+      return out;
+   }
+
+   bytes account_row( int64_t amount ) {
+      bytes out;
+      put_asset( out, amount, symbol( 4, "SYS" ) );
+      return out;
+   }
+
+   std::string hex( const bytes& data ) {
+      static const char* digits = "0123456789abcdef";
+      std::string out;
+      for( char c : data ) {
+         out += digits[uint8_t(c) >> 4];
+         out += digits[uint8_t(c) & 0x0f];
+      }
+      return out;
+   }
+
+   struct table {
+      std::string        code, scope, name;
+      std::vector<bytes> rows;
+   };
+
+   void put_section( bytes& out, const std::string& section, uint64_t rows, const bytes& body ) {
+      put( out, uint64_t( sizeof(uint64_t) + section.size() + 1 + body.size() ) );
+      put( out, rows );
+      out.insert( out.end(), section.begin(), section.end() );
+      out.push_back( 0 );
+      out.insert( out.end(), body.begin(), body.end() );
+   }
+
+   bytes snapshot( const std::vector<table>& tables ) {
+      bytes out;
+      put( out, uint32_t(0x30510550) );
+      put( out, uint32_t(2) );
+
+      bytes header;
+      put( header, uint32_t(2) );
+      put_section( out, "eosio::chain::chain_snapshot_header", 1, header );
+
+      bytes body;
+      uint64_t rows = 0;
+      for( const auto& t : tables ) {
+         put( body, name( t.code ) );
+         put( body, name( t.scope ) );
+         put( body, name( t.name ) );
+         put( body, name( t.code ) );
+         put( body, uint32_t( t.rows.size() + 1 ) );
+         put_varuint32( body, uint32_t(t.rows.size()) );
+         for( size_t i = 0; i < t.rows.size(); ++i ) {
+            put( body, uint64_t(i) );
+            put( body, name( t.code ) );
+            put_varuint32( body, uint32_t(t.rows[i].size()) );
+            body.insert( body.end(), t.rows[i].begin(), t.rows[i].end() );
+         }
+         // one idx64 row, every other secondary index empty
+         put_varuint32( body, 1 );
+         put( body, uint64_t(0) );
+         put( body, name( t.code ) );
+         put( body, uint64_t(42) );
+         for( int i = 0; i < 4; ++i )
+            put_varuint32( body, 0 );
+         rows += 1 + 6 + t.rows.size() + 1;
+      }
+      put_section( out, "contract_tables", rows, body );
+
+      bytes trailing;
+      put( trailing, uint64_t(0) );
+      put_section( out, "eosio::chain::resource_limits::resource_usage_object", 1, trailing );
+
+      put( out, uint64_t(-1) );
+      return out;
+   }
+
+   bool write( const std::string& path, const std::string& text ) {
+      std::ofstream file( path, std::ios::binary );
+      file << text;
+      return bool(file);
+   }
+
+} /// namespace
+
+int main( int argc, char** argv ) {
+   if( argc != 2 ) {
+      std::cerr << "usage: " << argv[0] << " <output directory>\n";
+      return 2;
+   }
+   const std::string dir = argv[1];
+
+   const bytes legacy = order_row( 0, 5, "line 1\nline 2", false );
+   const bytes interned = order_row( 1, 6, "", true );
+
+   const std::string rows = "# orders\n" + hex( legacy ) + "\n  " + hex( interned ) + " \n";
+   const std::string page = "{\"rows\":[\"" + hex( legacy ) + "\",{\"data\":\"" + hex( interned ) + "\",\"payer\":\"orderdebt\"}],\"more\":false}\n";
+
+   const bytes state = snapshot( {
+      { "eosio.token", "alice", "accounts", { account_row( 12345 ) } },
+      { "eosio.token", "bob", "accounts", { account_row( -7 ) } },
+      { "eosio.token", "sys", "stat", {} },
+      { "orderdebt", "orderdebt", "accounts", { account_row( 1 ) } },
+      { "orderdebt", "orderdebt", "orders", { legacy, interned } },
+   } );
+
+   const bool ok = write( dir + "/orders.hex", rows )
+                && write( dir + "/orders.page", page )
+                && write( dir + "/state.bin", std::string( state.begin(), state.end() ) );
+   return ok ? 0 : 1;
+}
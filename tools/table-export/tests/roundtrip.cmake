@@ -0,0 +1,28 @@
+# Runs table-export over the inputs written by table-export-fixture and compares the output
+# with the files in expected/. Called by ctest with EXPORT, FIXTURE, EXPECTED and WORK_DIR set.
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+execute_process(COMMAND ${FIXTURE} ${WORK_DIR} RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+   message(FATAL_ERROR "table-export-fixture failed")
+endif()
+
+function(check_export expected)
+   execute_process(COMMAND ${EXPORT} ${ARGN}
+                   OUTPUT_FILE ${WORK_DIR}/${expected}
+                   RESULT_VARIABLE result)
+   if(NOT result EQUAL 0)
+      message(FATAL_ERROR "table-export ${ARGN} failed")
+   endif()
+   execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK_DIR}/${expected} ${EXPECTED}/${expected}
+                   RESULT_VARIABLE result)
+   if(NOT result EQUAL 0)
+      message(FATAL_ERROR "${WORK_DIR}/${expected} differs from ${EXPECTED}/${expected}")
+   endif()
+endfunction()
+
+check_export(orders.ndjson --table orders ${WORK_DIR}/orders.hex)
+check_export(orders.page.ndjson --table orders ${WORK_DIR}/orders.page)
+check_export(orders.csv --table orders --format csv ${WORK_DIR}/orders.hex)
+check_export(accounts.snapshot.ndjson --table accounts --snapshot ${WORK_DIR}/state.bin --code eosio.token)
+check_export(orders.snapshot.ndjson --table orders --snapshot ${WORK_DIR}/state.bin --code orderdebt)